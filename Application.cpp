@@ -1,14 +1,22 @@
 #include "Application.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <stdexcept>
 #include <SDL2/SDL_syswm.h>
 #include <unordered_map>
+#include <utility>
 
+#include "BmpFile.hpp"
 #include "Image.hpp"
+#include "ImageFile.hpp"
 #include "Logger.hpp"
-#include "UnsupportedDedicatedPalette.hpp"
+#include "TransformComparison.hpp"
 
 namespace
 {
@@ -17,8 +25,15 @@ constexpr int openFile4BitId = 41;
 
 constexpr int saveFileId = 2;
 constexpr int saveFile4BitId = 42;
+constexpr int saveFileProgressiveId = 43;
+constexpr int exportBmpId = 44;
+constexpr int exportBmpRle4Id = 45;
+constexpr int exportBmp1BitMedianCutId = 48;
+constexpr int exportBmp8BitMedianCutId = 49;
 
 constexpr int closeFileId = 3;
+constexpr int undoId = 46;
+constexpr int redoId = 47;
 
 constexpr int imposedPaletteTransformationId = 10;
 constexpr int dedicatedPaletteTransformationId = 11;
@@ -27,9 +42,63 @@ constexpr int ditheringTransformationId = 13;
 constexpr int ditheringGreyscaleTransformationId = 14;
 constexpr int medianCutTransformationId = 15;
 constexpr int medianCutGreyscaleTransformationId = 16;
+constexpr int floydSteinbergTransformationId = 17;
+constexpr int atkinsonTransformationId = 18;
+constexpr int jarvisJudiceNinkeTransformationId = 19;
+constexpr int ditheringGreyscaleLevelsTransformationId = 20;
+constexpr int medianCutDitheringTransformationId = 21;
+constexpr int blueNoiseDitheringTransformationId = 22;
+constexpr int blueNoiseDitheringGreyscaleTransformationId = 23;
+constexpr int compareTransformationsId = 24;
+
+constexpr UINT taskDoneMessage = WM_APP + 1;
+// Posted by the comparison workers with the index of a finished result
+constexpr UINT comparisonResultMessage = WM_APP + 2;
+constexpr UINT_PTR progressTimerId = 1;
+constexpr UINT progressInterval = 100;
 
 const std::string kFileName = "obraz4.bin";
 
+struct ComparedTransformation
+{
+    Image::Transformation transformation;
+    const char* name;
+};
+
+// Cells of the comparison grid after the original, which takes the first one
+const std::array<ComparedTransformation, 14> comparedTransformations{
+    ComparedTransformation{Image::Transformation::imposedPalette, "Paleta narzucona"},
+    ComparedTransformation{Image::Transformation::dedicatedPalette, "Paleta dedykowana"},
+    ComparedTransformation{Image::Transformation::greyscale, "Skala szarosci"},
+    ComparedTransformation{Image::Transformation::dithering, "Dithering"},
+    ComparedTransformation{Image::Transformation::ditheringGreyscale, "Dithering Skala szarosci"},
+    ComparedTransformation{Image::Transformation::ditheringGreyscaleLevels, "Dithering 16 odcieni"},
+    ComparedTransformation{Image::Transformation::blueNoiseDithering, "Dithering Blue Noise"},
+    ComparedTransformation{Image::Transformation::blueNoiseDitheringGreyscale, "Dithering Blue Noise Skala szarosci"},
+    ComparedTransformation{Image::Transformation::medianCut, "Median Cut"},
+    ComparedTransformation{Image::Transformation::medianCutGreyscale, "Median Cut Skala szarosci"},
+    ComparedTransformation{Image::Transformation::medianCutDithering, "Median Cut Dithering"},
+    ComparedTransformation{Image::Transformation::floydSteinberg, "Floyd-Steinberg"},
+    ComparedTransformation{Image::Transformation::atkinson, "Atkinson"},
+    ComparedTransformation{Image::Transformation::jarvisJudiceNinke, "Jarvis-Judice-Ninke"},
+};
+constexpr int comparisonColumns = 5;
+constexpr int comparisonRows = 3;
+
+// Glyphs of 3 by 5 pixels for the labels of the comparison grid, one octal digit for each row from the top with the
+// leftmost pixel in the highest bit. Characters without a glyph are left blank.
+constexpr char glyphCharacters[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.-:()/";
+constexpr std::array<int, sizeof(glyphCharacters) - 1> glyphs{
+    075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717,
+    025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 011152, 055655, 044447, 057755,
+    065555, 025552, 065644, 025563, 065655, 034216, 072222, 055557, 055552, 055775, 055255, 055222, 071247,
+    000002, 000700, 002020, 012221, 042224, 011244,
+};
+constexpr int glyphWidth = 3;
+constexpr int glyphHeight = 5;
+constexpr int labelLines = 3;
+constexpr int labelHeight = labelLines * (glyphHeight + 1);
+
 LRESULT CALLBACK WndProc(const HWND hwnd, const UINT msg, const WPARAM wParam, const LPARAM lParam)
 {
     Application* app;
@@ -57,7 +126,8 @@ LRESULT CALLBACK WndProc(const HWND hwnd, const UINT msg, const WPARAM wParam, c
 
 void setPixel(const SDL_Surface* surface, const int x, const int y, const SDL_Color& color)
 {
-    if (x < 0 or x >= surface->w or y < 0 or y >= surface->h)
+    // Every pixel takes two by two pixels of the surface
+    if (x < 0 or 2 * x >= surface->w or y < 0 or 2 * y >= surface->h)
     {
         return;
     }
@@ -130,6 +200,72 @@ void setPixel(const SDL_Surface* surface, const int x, const int y, const SDL_Co
             throw std::runtime_error("Not supported bpp");
     }
 }
+
+// Upper case text in white from the top left corner, cut at maxWidth
+void drawText(const SDL_Surface* surface, const int left, const int top, const std::string& text, const int maxWidth)
+{
+    for (size_t i{0}; i < text.size() and static_cast<int>(i + 1) * (glyphWidth + 1) <= maxWidth; ++i)
+    {
+        const char character = static_cast<char>(std::toupper(static_cast<unsigned char>(text[i])));
+        const char* found = std::strchr(glyphCharacters, character);
+        if (character == '\0' or not found)
+        {
+            continue;
+        }
+
+        const int glyph = glyphs[found - glyphCharacters];
+        for (int row{0}; row < glyphHeight; ++row)
+        {
+            for (int column{0}; column < glyphWidth; ++column)
+            {
+                if (glyph >> ((glyphHeight - 1 - row) * glyphWidth + glyphWidth - 1 - column) & 1)
+                {
+                    setPixel(surface, left + static_cast<int>(i) * (glyphWidth + 1) + column, top + row, SDL_Color{255, 255, 255, 255});
+                }
+            }
+        }
+    }
+}
+
+std::optional<std::string> chooseBmpFile(const HWND hwnd)
+{
+    OPENFILENAME ofn;
+    std::string fileName(MAX_PATH, '\0');
+
+    ZeroMemory(&ofn, sizeof(ofn));
+
+    ofn.lStructSize = sizeof(OPENFILENAME);
+    ofn.hwndOwner = hwnd;
+    ofn.lpstrFilter = "Bitmaps\0*.BMP\0";
+    ofn.lpstrFile = &fileName[0];
+    ofn.nMaxFile = MAX_PATH;
+    ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
+    ofn.lpstrDefExt = "bmp";
+
+    if (not GetSaveFileName(&ofn))
+    {
+        return std::nullopt;
+    }
+
+    fileName.resize(fileName.find('\0'));
+    return fileName;
+}
+
+// Name, time and quality of a compared transformation, a line each
+std::vector<std::string> describeResult(const char* name, const TransformComparison::Result& result)
+{
+    if (not result.error.empty())
+    {
+        return {name, "Blad"};
+    }
+
+    std::ostringstream time;
+    std::ostringstream quality;
+    time << std::fixed << std::setprecision(1) << result.milliseconds << " ms PSNR " << result.quality.totalPeakSignalToNoiseRatio;
+    quality << std::fixed << std::setprecision(3) << "SSIM " << result.quality.structuralSimilarity << std::setprecision(1) << " dE "
+            << result.quality.meanDeltaE << "/" << result.quality.maxDeltaE;
+    return {name, time.str(), quality.str()};
+}
 }
 
 Application::Application()
@@ -163,6 +299,12 @@ Application::Application()
 
 Application::~Application()
 {
+    if (worker.joinable())
+    {
+        task->cancel();
+        worker.join();
+    }
+
     Logger::Log("Remove all .bin files");
     if (std::filesystem::exists(kFileName)) {
         std::error_code error;
@@ -210,19 +352,38 @@ void Application::initMenuBar()
     HMENU hFileMenu = CreatePopupMenu();
     AppendMenu(hFileMenu, MF_STRING, openFileId, "Wczytaj");
     AppendMenu(hFileMenu, MF_STRING, saveFileId, "Zapisz");
+    AppendMenu(hFileMenu, MF_STRING, saveFileProgressiveId, "Zapisz progresywnie");
+    AppendMenu(hFileMenu, MF_STRING, exportBmpId, "Eksportuj BMP 4-bit");
+    AppendMenu(hFileMenu, MF_STRING, exportBmpRle4Id, "Eksportuj BMP 4-bit RLE");
+    AppendMenu(hFileMenu, MF_STRING, exportBmp1BitMedianCutId, "Eksportuj BMP 1-bit Median Cut");
+    AppendMenu(hFileMenu, MF_STRING, exportBmp8BitMedianCutId, "Eksportuj BMP 8-bit Median Cut");
     AppendMenu(hFileMenu, MF_STRING, saveFile4BitId, "Zapisz 4-bit");
     AppendMenu(hFileMenu, MF_STRING, openFile4BitId, "Wczytaj 4-bit");
     AppendMenu(hFileMenu, MF_STRING, closeFileId, "Zamknij");
     AppendMenu(hMenu, MF_STRING | MF_POPUP, reinterpret_cast<UINT_PTR>(hFileMenu), "Obraz");
 
+    HMENU hEditMenu = CreatePopupMenu();
+    AppendMenu(hEditMenu, MF_STRING, undoId, "Cofnij");
+    AppendMenu(hEditMenu, MF_STRING, redoId, "Ponow");
+    AppendMenu(hMenu, MF_STRING | MF_POPUP, reinterpret_cast<UINT_PTR>(hEditMenu), "Edycja");
+
     HMENU hTransformMenu = CreatePopupMenu();
     AppendMenu(hTransformMenu, MF_STRING, imposedPaletteTransformationId, "Paleta narzucona");
     AppendMenu(hTransformMenu, MF_STRING, dedicatedPaletteTransformationId, "Paleta dedykowana");
     AppendMenu(hTransformMenu, MF_STRING, greyscaleTransformationId, "Skala szaro�ci");
     AppendMenu(hTransformMenu, MF_STRING, ditheringTransformationId, "Dithering");
     AppendMenu(hTransformMenu, MF_STRING, ditheringGreyscaleTransformationId, "Dithering Skala szaro�ci");
+    AppendMenu(hTransformMenu, MF_STRING, ditheringGreyscaleLevelsTransformationId, "Dithering 16 odcieni Skala szaro�ci");
+    AppendMenu(hTransformMenu, MF_STRING, blueNoiseDitheringTransformationId, "Dithering Blue Noise");
+    AppendMenu(hTransformMenu, MF_STRING, blueNoiseDitheringGreyscaleTransformationId, "Dithering Blue Noise Skala szaro�ci");
     AppendMenu(hTransformMenu, MF_STRING, medianCutTransformationId, "Median Cut");
     AppendMenu(hTransformMenu, MF_STRING, medianCutGreyscaleTransformationId, "Median Cut Skala szaro�ci");
+    AppendMenu(hTransformMenu, MF_STRING, medianCutDitheringTransformationId, "Median Cut Dithering");
+    AppendMenu(hTransformMenu, MF_STRING, floydSteinbergTransformationId, "Dithering Floyd-Steinberg");
+    AppendMenu(hTransformMenu, MF_STRING, atkinsonTransformationId, "Dithering Atkinson");
+    AppendMenu(hTransformMenu, MF_STRING, jarvisJudiceNinkeTransformationId, "Dithering Jarvis-Judice-Ninke");
+    AppendMenu(hTransformMenu, MF_SEPARATOR, 0, nullptr);
+    AppendMenu(hTransformMenu, MF_STRING, compareTransformationsId, "Porownaj wszystkie");
     AppendMenu(hMenu, MF_STRING | MF_POPUP, reinterpret_cast<UINT_PTR>(hTransformMenu), "Transformacje");
 
     SetMenu(hwnd, hMenu);
@@ -239,8 +400,40 @@ LRESULT Application::handleMenuBar(const HWND hwnd, const UINT msg, const WPARAM
                     loadImage(hwnd);
                     break;
 
+                case saveFileId:
+                    saveImage(hwnd, false);
+                    break;
+
+                case saveFileProgressiveId:
+                    saveImage(hwnd, true);
+                    break;
+
+                case exportBmpId:
+                    exportBmp(hwnd, BmpCompression::none);
+                    break;
+
+                case exportBmpRle4Id:
+                    exportBmp(hwnd, BmpCompression::rle4);
+                    break;
+
+                case exportBmp1BitMedianCutId:
+                    exportMedianCutBmp(hwnd, 1);
+                    break;
+
+                case exportBmp8BitMedianCutId:
+                    exportMedianCutBmp(hwnd, 8);
+                    break;
+
                 case closeFileId:
-                    closeImage();
+                    closeImage(hwnd);
+                    break;
+
+                case undoId:
+                    stepHistory(hwnd, false);
+                    break;
+
+                case redoId:
+                    stepHistory(hwnd, true);
                     break;
 
                 case openFile4BitId:
@@ -252,66 +445,63 @@ LRESULT Application::handleMenuBar(const HWND hwnd, const UINT msg, const WPARAM
                     break;
 
                 case imposedPaletteTransformationId:
-                    if (image)
-                    {
-                        image->transform(Image::Transformation::imposedPalette);
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::imposedPalette);
                     break;
 
                 case dedicatedPaletteTransformationId:
-                    if (image)
-                    {
-                        try
-                        {
-                            image->transform(Image::Transformation::dedicatedPalette);
-                        }
-                        catch (const UnsupportedDedicatedPalette& e)
-                        {
-                            MessageBox(hwnd, e.what(), "Error", MB_OK | MB_ICONERROR);
-                        }
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::dedicatedPalette);
                     break;
 
                 case greyscaleTransformationId:
-                    if (image)
-                    {
-                        image->transform(Image::Transformation::greyscale);
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::greyscale);
                     break;
 
                 case ditheringTransformationId:
-                    if (image)
-                    {
-                        image->transform(Image::Transformation::dithering);
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::dithering);
                     break;
 
                 case ditheringGreyscaleTransformationId:
-                    if (image)
-                    {
-                        image->transform(Image::Transformation::ditheringGreyscale);
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::ditheringGreyscale);
+                    break;
+
+                case ditheringGreyscaleLevelsTransformationId:
+                    transformImage(hwnd, Image::Transformation::ditheringGreyscaleLevels);
+                    break;
+
+                case blueNoiseDitheringTransformationId:
+                    transformImage(hwnd, Image::Transformation::blueNoiseDithering);
+                    break;
+
+                case blueNoiseDitheringGreyscaleTransformationId:
+                    transformImage(hwnd, Image::Transformation::blueNoiseDitheringGreyscale);
                     break;
 
                 case medianCutTransformationId:
-                    if (image)
-                    {
-                        image->transform(Image::Transformation::medianCut);
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::medianCut);
                     break;
 
                 case medianCutGreyscaleTransformationId:
-                    if (image)
-                    {
-                        image->transform(Image::Transformation::medianCutGreyscale);
-                        updateView();
-                    }
+                    transformImage(hwnd, Image::Transformation::medianCutGreyscale);
+                    break;
+
+                case medianCutDitheringTransformationId:
+                    transformImage(hwnd, Image::Transformation::medianCutDithering);
+                    break;
+
+                case floydSteinbergTransformationId:
+                    transformImage(hwnd, Image::Transformation::floydSteinberg);
+                    break;
+
+                case atkinsonTransformationId:
+                    transformImage(hwnd, Image::Transformation::atkinson);
+                    break;
+
+                case jarvisJudiceNinkeTransformationId:
+                    transformImage(hwnd, Image::Transformation::jarvisJudiceNinke);
+                    break;
+
+                case compareTransformationsId:
+                    compareTransformations(hwnd);
                     break;
 
                 default:
@@ -319,7 +509,23 @@ LRESULT Application::handleMenuBar(const HWND hwnd, const UINT msg, const WPARAM
             }
             break;
 
+        case taskDoneMessage:
+            finishTask(hwnd, wParam);
+            break;
+
+        case comparisonResultMessage:
+            showComparisonResult(wParam);
+            break;
+
+        case WM_TIMER:
+            if (wParam == progressTimerId)
+            {
+                showProgress();
+            }
+            break;
+
         case WM_DESTROY:
+            cancelTask(hwnd);
             running = false;
             PostQuitMessage(0);
             break;
@@ -334,14 +540,13 @@ LRESULT Application::handleMenuBar(const HWND hwnd, const UINT msg, const WPARAM
 void Application::loadImage(const HWND hwnd)
 {
     OPENFILENAME ofn;
-    std::string fileName{};
-    fileName.reserve(MAX_PATH);
+    std::string fileName(MAX_PATH, '\0');
 
     ZeroMemory(&ofn, sizeof(ofn));
 
     ofn.lStructSize = sizeof(OPENFILENAME);
     ofn.hwndOwner = hwnd;
-    ofn.lpstrFilter = "Bitmaps\0*.BMP\0";
+    ofn.lpstrFilter = "Bitmaps\0*.BMP\0GK_PROJEKT_FILE\0*.gkimg\0";
     ofn.lpstrFile = &fileName[0];
     ofn.nMaxFile = MAX_PATH;
     ofn.Flags = OFN_EXPLORER | OFN_FILEMUSTEXIST | OFN_HIDEREADONLY;
@@ -349,18 +554,23 @@ void Application::loadImage(const HWND hwnd)
 
     if (GetOpenFileName(&ofn))
     {
+        fileName.resize(fileName.find('\0'));
         clearScreen();
-        image = std::make_unique<Image>(fileName);
+
+        // A progressive file comes back as a preview first, finishTask then reads the rest of it
+        loadingFileName = fileName;
+        startTask(hwnd, [fileName](TaskControl&)
+                      {
+                          return std::make_unique<Image>(fileName, true);
+                      });
     }
     else
     {
         throw std::runtime_error("Failed to load image");
     }
-
-    updateView();
 }
 
-void Application::saveImage(const HWND hwnd) const
+void Application::saveImage(const HWND hwnd, const bool progressive) const
 {
     if (not image or not image->isTransformed())
     {
@@ -369,8 +579,7 @@ void Application::saveImage(const HWND hwnd) const
     }
 
     OPENFILENAME ofn;
-    std::string fileName{};
-    fileName.reserve(MAX_PATH);
+    std::string fileName(MAX_PATH, '\0');
 
     ZeroMemory(&ofn, sizeof(ofn));
 
@@ -384,15 +593,417 @@ void Application::saveImage(const HWND hwnd) const
 
     if (GetSaveFileName(&ofn))
     {
+        fileName.resize(fileName.find('\0'));
         std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
-        file << *image;
+        writeImageFile(file, image->getIndexed(), progressive);
+    }
+}
+
+void Application::exportBmp(const HWND hwnd, const BmpCompression compression) const
+{
+    if (not image or not image->isTransformed())
+    {
+        MessageBox(hwnd, "Brak obrazu do zapisania", "Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    if (const auto fileName = chooseBmpFile(hwnd))
+    {
+        std::ofstream file(fileName.value(), std::ios::binary | std::ios::trunc);
+        writeBmpFile(file, image->getIndexed(), compression);
+    }
+}
+
+void Application::exportMedianCutBmp(const HWND hwnd, const unsigned bits) const
+{
+    if (not image)
+    {
+        MessageBox(hwnd, "Brak obrazu do zapisania", "Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    if (const auto fileName = chooseBmpFile(hwnd))
+    {
+        std::ofstream file(fileName.value(), std::ios::binary | std::ios::trunc);
+        if (bits == 1)
+        {
+            writeBmpFile(file, image->medianCutIndexed<1>(false));
+        }
+        else
+        {
+            writeBmpFile(file, image->medianCutIndexed<8>(false));
+        }
     }
 }
 
-void Application::closeImage()
+void Application::transformImage(const HWND hwnd, const Image::Transformation transformation)
 {
+    if (not image)
+    {
+        return;
+    }
+
+    const bool deferred = deferUntilLoaded(hwnd, [this, hwnd, transformation]
+                                               {
+                                                   transformImage(hwnd, transformation);
+                                               });
+    if (deferred)
+    {
+        return;
+    }
+
+    // The worker transforms a copy, so the image on screen stays intact until the result replaces it
+    startTask(hwnd, [source = *image, transformation, cache = &resultCache](TaskControl& control) mutable
+                  {
+                      TransformOptions options;
+                      options.control = &control;
+                      options.cache = cache;
+                      source.transform(transformation, options);
+                      return std::make_unique<Image>(std::move(source));
+                  });
+}
+
+void Application::closeImage(const HWND hwnd)
+{
+    cancelTask(hwnd);
     image = nullptr;
+    history.clear();
+    leaveComparison();
+    updateView();
+    updateTitle();
+}
+
+void Application::stepHistory(const HWND hwnd, const bool forward)
+{
+    // Until the full image is loaded, the history still belongs to the image before it
+    if (not image or image->isPreview() or not (forward ? history.canRedo() : history.canUndo()))
+    {
+        return;
+    }
+
+    // A transformation still running would replace the state stepped to
+    cancelTask(hwnd);
+    if (forward)
+    {
+        history.redo(*image);
+    }
+    else
+    {
+        history.undo(*image);
+    }
+
+    leaveComparison();
+    clearScreen();
+    updateView();
+    updateTitle();
+}
+
+void Application::compareTransformations(const HWND hwnd)
+{
+    if (not image)
+    {
+        return;
+    }
+
+    const bool deferred = deferUntilLoaded(hwnd, [this, hwnd]
+                                               {
+                                                   compareTransformations(hwnd);
+                                               });
+    if (deferred)
+    {
+        return;
+    }
+
+    cancelTask(hwnd);
+    {
+        const std::lock_guard<std::mutex> lock{comparisonMutex};
+        comparisonResults.assign(comparedTransformations.size(), std::nullopt);
+    }
+
+    comparing = true;
+    clearScreen();
+    const auto& original = image->getOriginalBmp();
+    drawThumbnail(original.size(), original[0].size(), 0, [&original](const size_t x, const size_t y)
+                      {
+                          return original[x][y];
+                      });
+    drawLabel(0, {"Oryginal"});
+    SDL_UpdateWindowSurface(window);
+
+    // The job gives no image, the results reach the window as comparisonResultMessage
+    startTask(hwnd, [this, hwnd, source = *image](TaskControl& control)
+                  {
+                      std::vector<Image::Transformation> transformations;
+                      for (const auto& compared : comparedTransformations)
+                      {
+                          transformations.push_back(compared.transformation);
+                      }
+
+                      TransformOptions options;
+                      options.control = &control;
+                      TransformComparison{options}.perform(source, transformations, [this, hwnd](const size_t index, const TransformComparison::Result& result)
+                                                               {
+                                                                   {
+                                                                       const std::lock_guard<std::mutex> lock{comparisonMutex};
+                                                                       comparisonResults[index] = result;
+                                                                   }
+                                                                   PostMessage(hwnd, comparisonResultMessage, index, 0);
+                                                               });
+                      return std::unique_ptr<Image>{};
+                  });
+}
+
+void Application::showComparisonResult(const WPARAM index)
+{
+    // Results of a comparison that was cancelled may still arrive
+    const std::lock_guard<std::mutex> lock{comparisonMutex};
+    if (not comparing or index >= comparisonResults.size() or not comparisonResults[index])
+    {
+        return;
+    }
+
+    const int cell = static_cast<int>(index) + 1;
+    if (const auto& image = comparisonResults[index]->image)
+    {
+        const auto& result = image.value();
+        const size_t lineSize = IndexedFormat<defaultBits>::packedSize(result.length);
+        std::vector<Uint8> indices(result.length);
+        size_t unpackedLine{result.lines};
+
+        drawThumbnail(result.lines, result.length, cell, [&](const size_t x, const size_t y)
+                          {
+                              if (x != unpackedLine)
+                              {
+                                  IndexedFormat<defaultBits>::unpack(result.indices.data() + x * lineSize, result.length, indices.data());
+                                  unpackedLine = x;
+                              }
+                              return result.palette[indices[y]];
+                          });
+    }
+    drawLabel(cell, describeResult(comparedTransformations[index].name, comparisonResults[index].value()));
+    SDL_UpdateWindowSurface(window);
+}
+
+void Application::showComparisonSummary(const HWND hwnd)
+{
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1);
+
+    {
+        const std::lock_guard<std::mutex> lock{comparisonMutex};
+        for (size_t i{0}; i < comparisonResults.size(); ++i)
+        {
+            summary << comparedTransformations[i].name << ": ";
+            if (not comparisonResults[i])
+            {
+                summary << "-\n";
+            }
+            else if (not comparisonResults[i]->error.empty())
+            {
+                summary << comparisonResults[i]->error << "\n";
+            }
+            else
+            {
+                const auto& quality = comparisonResults[i]->quality;
+                summary << comparisonResults[i]->milliseconds << " ms, PSNR " << quality.totalPeakSignalToNoiseRatio << " dB, SSIM "
+                        << std::setprecision(3) << quality.structuralSimilarity << std::setprecision(1) << ", dE " << quality.meanDeltaE << " (max "
+                        << quality.maxDeltaE << ")\n";
+            }
+        }
+    }
+
+    MessageBox(hwnd, summary.str().c_str(), "Porownanie", MB_OK | MB_ICONINFORMATION);
+}
+
+void Application::leaveComparison()
+{
+    if (comparing)
+    {
+        comparing = false;
+        clearScreen();
+    }
+}
+
+// Cell of the comparison grid above its label, the image scaled down by picking the nearest pixel to fit it
+void Application::drawThumbnail(const size_t lines, const size_t length, const int cell, const std::function<SDL_Color(size_t, size_t)>& pixel) const
+{
+    const int cellWidth = width / comparisonColumns;
+    const int cellHeight = height / comparisonRows - labelHeight;
+    const int left = cell % comparisonColumns * cellWidth;
+    const int top = cell / comparisonColumns * (cellHeight + labelHeight);
+
+    const size_t scale = std::max({size_t{1}, (lines + cellWidth - 2) / (cellWidth - 1), (length + cellHeight - 2) / (cellHeight - 1)});
+    for (size_t x{0}; x < lines; x += scale)
+    {
+        for (size_t y{0}; y < length; y += scale)
+        {
+            setPixel(screen, left + static_cast<int>(x / scale), top + static_cast<int>(y / scale), pixel(x, y));
+        }
+    }
+}
+
+// Lines of text along the bottom of a cell of the comparison grid
+void Application::drawLabel(const int cell, const std::vector<std::string>& lines) const
+{
+    const int cellWidth = width / comparisonColumns;
+    const int cellHeight = height / comparisonRows;
+    const int left = cell % comparisonColumns * cellWidth;
+    const int top = (cell / comparisonColumns + 1) * cellHeight - labelHeight;
+
+    for (size_t line{0}; line < lines.size(); ++line)
+    {
+        drawText(screen, left, top + static_cast<int>(line) * (glyphHeight + 1), lines[line], cellWidth - 1);
+    }
+}
+
+// A task started while the full image behind a preview loads would cancel the load and work on the preview, so it
+// waits for the load instead. Only the last one asked for runs.
+bool Application::deferUntilLoaded(const HWND hwnd, std::function<void()> action)
+{
+    if (not image->isPreview())
+    {
+        return false;
+    }
+
+    if (worker.joinable())
+    {
+        afterLoad = std::move(action);
+    }
+    else
+    {
+        MessageBox(hwnd, "Obraz nie zostal wczytany w calosci", "Error", MB_OK | MB_ICONERROR);
+    }
+    return true;
+}
+
+void Application::startTask(const HWND hwnd, std::function<std::unique_ptr<Image>(TaskControl&)> job)
+{
+    cancelTask(hwnd);
+
+    task = std::make_unique<TaskControl>();
+    taskResult = nullptr;
+    taskState = std::nullopt;
+    taskError = nullptr;
+    ++taskGeneration;
+
+    worker = std::thread{[this, hwnd, job = std::move(job), control = task.get(), generation = taskGeneration]
+                             {
+                                 try
+                                 {
+                                     taskResult = job(*control);
+                                     if (taskResult and not taskResult->isPreview())
+                                     {
+                                         taskState = TransformHistory::snapshot(*taskResult);
+                                     }
+                                 }
+                                 catch (...)
+                                 {
+                                     taskError = std::current_exception();
+                                 }
+                                 PostMessage(hwnd, taskDoneMessage, generation, 0);
+                             }};
+
+    SetTimer(hwnd, progressTimerId, progressInterval, nullptr);
+}
+
+void Application::cancelTask(const HWND hwnd)
+{
+    afterLoad = nullptr;
+    if (worker.joinable())
+    {
+        task->cancel();
+        worker.join();
+    }
+
+    KillTimer(hwnd, progressTimerId);
+    updateTitle();
+}
+
+void Application::finishTask(const HWND hwnd, const WPARAM generation)
+{
+    // Cancelled tasks still post their message once they stop
+    if (generation != taskGeneration or not worker.joinable())
+    {
+        return;
+    }
+
+    worker.join();
+    KillTimer(hwnd, progressTimerId);
+    updateTitle();
+
+    if (taskError)
+    {
+        afterLoad = nullptr;
+        try
+        {
+            std::rethrow_exception(taskError);
+        }
+        catch (const TaskCancelled&)
+        {
+        }
+        catch (const std::exception& e)
+        {
+            MessageBox(hwnd, e.what(), "Error", MB_OK | MB_ICONERROR);
+        }
+        return;
+    }
+
+    // Only comparisons finish without an image
+    if (not taskResult)
+    {
+        showComparisonSummary(hwnd);
+        return;
+    }
+
+    leaveComparison();
+    image = std::move(taskResult);
     updateView();
+    updateTitle();
+
+    if (image->isPreview())
+    {
+        startTask(hwnd, [fileName = loadingFileName](TaskControl&)
+                      {
+                          return std::make_unique<Image>(fileName);
+                      });
+        return;
+    }
+
+    // Loads give images that are not transformed and start a new history
+    if (not image->isTransformed())
+    {
+        history.clear();
+    }
+    history.record(std::move(taskState.value()));
+
+    if (afterLoad)
+    {
+        std::exchange(afterLoad, nullptr)();
+    }
+}
+
+void Application::showProgress() const
+{
+    const int percent = static_cast<int>(task->getProgress() * 100.0);
+    SDL_SetWindowTitle(window, (title + " - " + std::to_string(percent) + "%").c_str());
+}
+
+void Application::updateTitle() const
+{
+    const auto transformation = image ? image->getTransformation() : Image::Transformation::none;
+    const bool medianCut = transformation == Image::Transformation::medianCut or transformation == Image::Transformation::medianCutGreyscale or
+                           transformation == Image::Transformation::medianCutDithering;
+    if (not medianCut or image->getPaletteSampling().sampledPixels >= image->getPaletteSampling().totalPixels)
+    {
+        SDL_SetWindowTitle(window, title.c_str());
+        return;
+    }
+
+    const auto& sampling = image->getPaletteSampling();
+    std::ostringstream text;
+    text << title << " - probka " << sampling.sampledPixels << "/" << sampling.totalPixels << " px, blad palety +/-" << std::fixed
+         << std::setprecision(1) << sampling.errorBound;
+    SDL_SetWindowTitle(window, text.str().c_str());
 }
 
 void Application::updateView() const
@@ -424,12 +1035,15 @@ void Application::drawImage(const std::vector<std::vector<SDL_Color>>& imageData
     }
 }
 
-void Application::drawPalette(const std::array<SDL_Color, 16>& palette, const int x, const int y) const
+template <size_t Size>
+void Application::drawPalette(const std::array<SDL_Color, Size>& palette, const int x, const int y) const
 {
+    // 16 swatches of 30 pixels fill the row, larger palettes get narrower swatches
+    constexpr int paletteSize = std::min(30, 480 / static_cast<int>(Size));
+
     for (size_t i{0}; i < palette.size(); ++i)
     {
         const auto& color = palette[i];
-        constexpr int paletteSize = 30;
 
         for (int j{0}; j < paletteSize; ++j)
         {
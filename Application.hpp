@@ -1,11 +1,21 @@
 #pragma once
+#include <array>
+#include <exception>
+#include <functional>
 #include <string>
+#include <thread>
 #include <windows.h>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <vector>
 #include <SDL2/SDL.h>
-
-class Image;
+#include "BmpFile.hpp"
+#include "Image.hpp"
+#include "ResultCache.hpp"
+#include "TaskControl.hpp"
+#include "TransformComparison.hpp"
+#include "TransformHistory.hpp"
 
 class Application
 {
@@ -27,13 +37,55 @@ private:
     const int height{400};
     const std::string title{"GK2024 - Projekt - Zespol 24"};
 
+    // Results of earlier transformations, shared by every image and kept between runs
+    ResultCache resultCache{"cache", 256 * 1024 * 1024};
+    // States of the image on screen to step back and forth between
+    TransformHistory history{128 * 1024 * 1024};
+
+    // Loads and transformations run on the worker one at a time, a new one cancels the one running. The result
+    // replaces the image when the window procedure gets the message the worker posts at the end.
+    std::thread worker;
+    std::unique_ptr<TaskControl> task;
+    WPARAM taskGeneration{0};
+    std::unique_ptr<Image> taskResult;
+    // State of the result for the history, encoded on the worker as well
+    std::optional<TransformHistory::State> taskState;
+    std::exception_ptr taskError;
+    std::string loadingFileName;
+    // Transformation or comparison asked for while the full image behind a preview loads, started once it is there
+    std::function<void()> afterLoad;
+
+    // The screen shows the comparison grid, whose results the comparison workers fill in as they finish
+    bool comparing{false};
+    std::mutex comparisonMutex;
+    std::vector<std::optional<TransformComparison::Result>> comparisonResults;
+
     void initMenuBar();
     void loadImage(HWND);
-    void saveImage(HWND) const;
-    void closeImage();
+    void saveImage(HWND, bool progressive) const;
+    void exportBmp(HWND, BmpCompression) const;
+    // Bitmap of the original image cut to 2^bits colors, 1 or 8 bits per pixel
+    void exportMedianCutBmp(HWND, unsigned bits) const;
+    void transformImage(HWND, Image::Transformation);
+    void closeImage(HWND);
+    void stepHistory(HWND, bool forward);
+    void compareTransformations(HWND);
+    void showComparisonResult(WPARAM);
+    void showComparisonSummary(HWND);
+    void leaveComparison();
+    void drawThumbnail(size_t lines, size_t length, int cell, const std::function<SDL_Color(size_t, size_t)>&) const;
+    void drawLabel(int cell, const std::vector<std::string>& lines) const;
+    bool deferUntilLoaded(HWND, std::function<void()>);
+    void startTask(HWND, std::function<std::unique_ptr<Image>(TaskControl&)>);
+    void cancelTask(HWND);
+    void finishTask(HWND, WPARAM);
+    void showProgress() const;
+    // The title, followed by the sample and error bound of the palette when the median cut behind the view was sampled
+    void updateTitle() const;
     void updateView() const;
     void drawImage(const std::vector<std::vector<SDL_Color>>&, int, int) const;
-    void drawPalette(const std::array<SDL_Color, 16>&, int, int) const;
+    template <size_t Size>
+    void drawPalette(const std::array<SDL_Color, Size>&, int, int) const;
     void clearScreen() const;
 
     uint8_t ConvertFrom24(const SDL_Color& color);
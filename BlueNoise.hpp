@@ -0,0 +1,269 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <SDL2/SDL.h>
+
+// 64x64 tileable blue noise threshold texture, generated offline with void-and-cluster
+// (toroidal Gaussian energy, sigma 1.5). Pixel ranks 0..4095 are scaled to 0..255,
+// so every value occurs exactly 16 times.
+inline constexpr size_t blueNoiseSize = 64;
+
+inline constexpr std::array<std::array<Uint8, blueNoiseSize>, blueNoiseSize> blueNoiseTexture{
+    std::array<Uint8, blueNoiseSize>{ 45, 144,  58, 213,  34, 167,  18, 179, 149,   9,  97, 224,  17, 116, 242, 210,
+                                     104, 175, 223, 159,   1,  59, 180,  19, 108, 144,  68,  42, 116,  84, 248, 146,
+                                     109, 217,  89, 197, 237,  79, 211,   7, 241, 148,  30, 180, 118,   0,  88, 154,
+                                     214,  24, 235, 139,  33, 113, 219,  75, 192, 126,  38,  73, 173, 121, 211, 165},
+    std::array<Uint8, blueNoiseSize>{112, 233,  82, 134, 241,  71, 121, 227,  63, 253, 129,  35, 198,  70, 163,  38,
+                                     191,  13,  76, 130, 197,  98, 214,  80, 255, 172, 195, 223, 155, 191,   0,  73,
+                                     179,  40, 151, 114,  22, 137,  39, 186,  91,  52, 203, 253,  59, 221, 192, 125,
+                                      45,  82, 102, 189,  59, 158,   3, 146, 245,  18, 230, 110, 200,  85, 239,  28},
+    std::array<Uint8, blueNoiseSize>{198,  14, 179, 105,   9, 202, 144,  36, 107, 208, 162,  54, 231, 144,   6, 128,
+                                      64, 253, 113,  40, 238, 146,  35, 134,  56,  28, 124,  14,  56, 100, 230, 136,
+                                     205,  15, 250,  53, 226, 172, 102, 230, 160, 125,  13,  86, 141,  39, 165,  19,
+                                     251, 202, 168,  15, 241, 203,  94,  40, 116, 177,  58, 158,   0, 138,  54, 149},
+    std::array<Uint8, blueNoiseSize>{ 92, 222,  38, 153, 187,  51, 220,  88, 186,  24,  81, 183, 110,  87, 178, 234,
+                                      95, 150, 217, 168,  17,  69, 175, 234, 102, 202,  88, 245, 143, 211,  30,  49,
+                                      96, 168, 128,  85, 192,  63, 130,  20,  74, 222, 168, 210, 109, 239,  70, 100,
+                                     134,  56, 147, 116,  80, 130, 229, 165,  71, 221,  92, 206,  43, 217, 180,  70},
+    std::array<Uint8, blueNoiseSize>{122, 166,  61, 252,  77, 113, 161,   2, 242, 124, 147,  14, 248,  31, 212,  44,
+                                     201,  24,  55,  90, 206, 109, 194,   9, 158, 225,  46, 181,  75, 166, 114, 184,
+                                     233,  62, 212,  30, 156,   2, 205, 240,  41, 111,  62,  31, 151,  12, 200, 176,
+                                     217,   9, 234,  37, 184,  19,  54, 188,   9, 139,  28, 122, 242,  98,  17, 248},
+    std::array<Uint8, blueNoiseSize>{209,  22, 139,  96, 204,  27, 233, 135,  70,  44, 218, 191,  60, 157, 114,  74,
+                                     166, 119, 187, 141, 245,  46, 126,  83,  25, 138, 109,  33, 130,   7, 253,  81,
+                                     123,   8, 146,  94, 220, 117,  81, 178, 137, 196, 248, 184,  83, 230, 117,  34,
+                                      77,  97, 193,  63, 155, 247, 103, 212,  85, 252, 192, 169,  59, 133, 156,  41},
+    std::array<Uint8, blueNoiseSize>{ 76, 189, 226,  11, 128,  48, 178,  99, 201, 164, 105,  77, 131, 223,   0, 140,
+                                     243,  15, 225,  78,   3, 160, 216, 251, 174,  67, 190, 239, 216,  60, 202,  25,
+                                     157, 193, 239,  40, 170, 255,  51, 150,  24,  95,   3, 131,  42, 164,  57, 146,
+                                     243, 161, 120, 221,  89, 139,  34, 125, 160,  48, 105,  74,   7, 196, 234, 106},
+    std::array<Uint8, blueNoiseSize>{144,  52, 114, 173, 238, 145, 214,  60,  30, 246,   8, 232,  36, 173,  96, 197,
+                                      65, 102,  39, 129, 182,  66,  32, 100,  49, 208, 154,  20,  86, 148, 103, 176,
+                                      46,  76, 108, 137,  69,  12, 102, 200, 230,  71, 159, 236, 108, 190, 221,   5,
+                                     200,  47,  25, 175,   1, 204, 181,  65, 229,  13, 214, 151, 227,  87,  28, 175},
+    std::array<Uint8, blueNoiseSize>{  2, 243,  83,  32,  65,  90,   9, 119, 187,  88, 144, 115, 202,  55, 255,  26,
+                                     180, 210, 162, 241, 110, 203, 151, 121, 236,   4,  95, 123, 173,  35, 222, 128,
+                                     245, 205,  16, 223, 181, 208, 128,  37, 169, 118,  53, 210,  21,  67,  97, 126,
+                                      83, 138, 254, 108,  52,  79, 240,  23, 115, 185, 130,  34, 178, 121,  50, 219},
+    std::array<Uint8, blueNoiseSize>{131, 201, 156, 220, 193, 167, 253, 152, 221,  47, 179,  24, 159,  90, 149, 123,
+                                      49, 137,  84,  21,  51, 229,  12, 196,  72, 136, 226,  53, 249, 195,  69,   2,
+                                      90, 147,  61, 120,  29, 155,  83, 245,  14, 223, 181,  85, 137, 251, 174,  23,
+                                     232, 183,  67, 151, 228, 130, 164,  97, 149,  55, 244,  95,  64, 255, 158,  93},
+    std::array<Uint8, blueNoiseSize>{178,  41, 105,  17, 125,  44, 107,  26,  74, 127, 209,  66, 236,  11, 215,  77,
+                                     235,  10, 220, 188,  97, 142,  81, 176,  38, 160, 187,  78,  15, 143, 101, 231,
+                                     170,  36, 189, 248,  98, 229,  58, 142, 110,  43, 148,   8, 199,  36, 154, 215,
+                                      43, 101,  11, 212, 179,  18,  43, 213, 192,  83,  22, 205, 139,  10, 198,  62},
+    std::array<Uint8, blueNoiseSize>{ 14, 250,  74, 148, 237,  81, 198, 228, 174,   3, 249, 107, 133, 185,  41, 173,
+                                     106, 147,  64, 122, 252,  27, 215, 109, 243,  21, 102, 216, 119,  38, 163,  55,
+                                     212, 126,  80, 161,  47,   3, 177, 216,  73, 194,  99, 229, 121,  56, 108,  77,
+                                     145, 202, 127,  37,  91, 118, 250,  68,   9, 236, 161, 114, 184,  39, 234, 118},
+    std::array<Uint8, blueNoiseSize>{221, 127, 209,  55, 185,   8, 140,  60, 101, 150,  84,  29, 200,  58, 120, 247,
+                                      33, 203, 165,  41, 178,  69, 154,  56, 129, 206,  47, 153, 180, 235, 199, 116,
+                                      26, 239,  11, 216, 113, 195, 125,  20, 158, 243,  29,  67, 164, 239, 184,   2,
+                                     247,  59, 164, 238,  72, 195, 143, 171, 109, 136,  48, 225,  72, 103, 151,  84},
+    std::array<Uint8, blueNoiseSize>{ 47, 166,  19,  96, 158, 113, 214,  37, 238, 195,  52, 167, 229,  99, 156,   4,
+                                      86, 225, 100,   6, 133, 201, 235,   9, 171,  86, 255,   3,  61,  89,  13,  75,
+                                     153,  95, 182,  57, 149,  82, 251,  95,  54, 131, 183, 214,  88,  18, 207, 124,
+                                      93, 190,  19, 107, 217,   3,  52, 229,  32, 215,  90,   0, 168, 211,  27, 190},
+    std::array<Uint8, blueNoiseSize>{141, 107, 196, 227,  30, 245,  68, 165,  13, 116, 221, 140,  15,  72, 210, 182,
+                                     139,  51, 190, 239,  84, 113,  44,  99, 196,  68, 139, 111, 219, 134, 245, 175,
+                                     206,  34, 133, 228,  22, 204,  36, 172, 207,   5, 115,  46, 151, 135,  53, 173,
+                                      34, 228, 138,  46, 175, 153,  96, 128,  76, 177, 146, 249,  55, 130, 244,  66},
+    std::array<Uint8, blueNoiseSize>{  4, 238,  40,  78, 135, 178,  91, 129, 188,  71,  33,  95, 244, 131,  38, 233,
+                                      69, 121,  19, 142, 213,  24, 182, 145, 226,  18, 166, 203,  32, 159,  45, 121,
+                                      63, 253, 103,  77, 168, 118,  67, 143, 236,  81, 166, 252,  27, 232, 100, 221,
+                                      68, 155,  84, 253, 120,  24, 239, 205,  14, 197,  36, 120, 194,  21,  87, 177},
+    std::array<Uint8, blueNoiseSize>{208,  89, 151, 187,  54,   1, 211,  47, 254, 148, 209, 179,  50, 196, 111,  22,
+                                     162, 254, 176,  73,  55, 161, 250,  62, 119,  39, 237,  96,  76, 193, 105, 222,
+                                       0, 146, 192,  45, 240,   7, 220, 102,  23, 191,  60, 106, 199,  73, 162,   7,
+                                     114, 187,  14, 200,  65, 184,  82, 163,  61, 105, 233,  70,  97, 163, 230, 118},
+    std::array<Uint8, blueNoiseSize>{157,  27, 124, 248, 105, 226, 153, 108,  18,  86, 123,  11, 152,  79, 172, 218,
+                                      93,  40, 105, 195, 229, 124,   2,  90, 209, 185,  57, 133,   8, 229,  27, 186,
+                                      89, 172,  18, 210, 129, 152, 183,  50, 124, 215, 140,  12, 180,  39, 130, 203,
+                                     246,  50, 134, 100,  35, 224, 138,  42, 251, 127, 156,  25, 223, 137,  15,  54},
+    std::array<Uint8, blueNoiseSize>{241,  68, 213,  17, 168,  75,  32, 196, 175, 235,  60, 227, 102, 249,   1,  57,
+                                     145, 206,  11, 152,  32,  98, 220, 138,  28, 156, 110, 248, 169, 145,  70, 129,
+                                      56, 232, 111,  65,  93,  31,  78, 247, 161,  40,  87, 225, 117, 241,  87,  23,
+                                     170,  78, 235, 208, 167, 112,  17, 211,  92,   3, 186, 209,  48, 179,  80, 200},
+    std::array<Uint8, blueNoiseSize>{115, 180,  45,  94, 202, 142, 242,  65, 134,  40, 163, 191,  28, 135, 201, 117,
+                                     241,  80, 131, 237,  50, 172, 192,  68, 234,  84,  16, 197,  46,  93, 242, 199,
+                                     162,  39, 142, 250, 160, 227, 197,  99,   1, 235, 173,  68, 154,  53, 217, 142,
+                                     106,  33, 157,   1,  57, 244,  78, 179, 152, 228,  59,  87, 117, 254,  34,  98},
+    std::array<Uint8, blueNoiseSize>{  6, 146, 224, 129,  57,   8, 119,  91, 213,   5, 114,  69, 216,  46,  75, 170,
+                                      18, 188,  61, 212, 118,  81,  14, 147,  42, 181, 219,  66, 124, 213,  36,   7,
+                                     101, 209,  23, 181,  52,  15, 117,  63, 146, 194, 104,  26, 204,   4, 176,  66,
+                                     198, 228, 123,  83, 147, 194, 132,  53, 114,  23, 140, 171,   9, 149, 216, 167},
+    std::array<Uint8, blueNoiseSize>{195,  74,  31, 252, 161, 189, 230,  48, 169, 251, 147,  96, 179, 156, 100, 227,
+                                      42, 160, 107,   5, 155, 242, 204, 108, 252,  97, 135, 160,  11, 179, 112, 147,
+                                     237,  77, 125,  90, 204, 133, 171, 214,  21, 125,  48, 255, 138,  92, 121, 247,
+                                      15,  49, 184, 218, 105,  38,  12, 237, 198,  74, 246, 100, 191,  66, 128,  47},
+    std::array<Uint8, blueNoiseSize>{244, 122, 207, 108,  83,  24, 150, 103,  28, 198,  54, 223,  10, 247,  21, 137,
+                                     206,  86, 247, 179,  34,  59, 129,  23, 168,  54,  31, 227,  88, 250,  71, 190,
+                                      57, 172, 221,   3, 241,  73,  38, 249,  85, 221, 159,  77, 186, 231,  36, 150,
+                                      99, 163,  64,  22, 254, 171, 213,  91, 158,  30, 210,  43, 225,  28, 233,  87},
+    std::array<Uint8, blueNoiseSize>{ 20, 157,  61,  10, 175, 215,  67, 205, 123,  77, 133,  37,  87, 122, 187,  64,
+                                     114,  26, 141,  74, 220,  92, 188, 225,  76, 207, 115, 173,  25, 140,  41, 224,
+                                      15, 135,  46, 105, 149, 185, 110, 157,  57, 181,  31, 116,  13,  60, 210,  79,
+                                     195, 236, 136,  94, 154,  72, 119,  47, 186, 131, 109, 161,  78, 143, 111, 178},
+    std::array<Uint8, blueNoiseSize>{214,  91, 192, 140, 238,  36, 132, 245,  17, 187, 160, 234, 200, 150,  46, 238,
+                                     174, 228,  51, 199, 123, 166,  44, 151,   0, 138, 242,  65, 107, 204, 164, 120,
+                                      94, 253, 165, 198,  60,  25, 209,   6, 138,  98, 244, 203, 164, 103, 173,  25,
+                                     124,   7, 212,  42, 200,   5, 142, 223,  18,  67, 238,  13, 183, 207,   0,  57},
+    std::array<Uint8, blueNoiseSize>{131,  29, 227,  49, 119,  94, 165,  47,  89, 219,   0, 103,  70,  27, 215,  94,
+                                      14, 155, 104,   7, 251,  21, 111, 237,  89, 197,  43, 185, 230,   4,  82, 187,
+                                      33, 208,  18,  83, 236, 130,  90, 239, 191,  18,  65, 132,  44, 218, 140, 252,
+                                      52, 180,  74, 117, 234, 174,  59, 249,  98, 152, 205,  52, 121,  93, 252, 168},
+    std::array<Uint8, blueNoiseSize>{237, 104, 152,  79, 202,   5, 222, 183, 149, 117,  58, 175, 242, 117, 165,  75,
+                                     128, 212,  70, 185, 147,  82, 201,  60, 124, 163,  17,  96, 127,  55, 246, 151,
+                                      67, 110, 155, 123,  37, 219, 174,  50, 115, 224, 154,  89, 237,   0,  69,  91,
+                                     157, 105, 244, 145,  31,  87, 112, 196,  39, 179,  85, 139, 229,  38, 151,  74},
+    std::array<Uint8, blueNoiseSize>{ 44, 188,  13, 170, 255,  60, 107,  20,  72, 251, 197,  41, 143,  20, 194, 254,
+                                      44, 177,  29, 118, 234,  40, 169, 215,  29, 254,  80, 145, 169, 211,  26, 130,
+                                     228,  47, 218, 188,  72, 150,  16,  79, 167,  35, 211,  22, 183, 114, 192, 224,
+                                      36, 203,  12,  61, 187, 219,  16, 158, 126,   3, 245,  25,  71, 197,  16, 123},
+    std::array<Uint8, blueNoiseSize>{211,  69, 231,  41, 122, 145, 196, 228, 135,  28, 157,  91, 222,  62, 104,   4,
+                                     141, 231,  99, 217,  61, 139,  10, 104, 183,  50, 218, 194,  36,  72,  99, 195,
+                                      12, 171,  93,   1, 249, 106, 202, 136, 247, 101, 126,  67, 161,  46, 134,  16,
+                                     175, 126, 227,  97, 165, 130,  48, 232,  75, 216, 113, 189, 159, 222,  98, 173},
+    std::array<Uint8, blueNoiseSize>{ 26, 113, 139,  89, 183,  29,  78, 167,  54, 109, 209,   8, 125, 183, 159, 207,
+                                      88,  52, 159,  18, 201,  95, 246, 153,  74, 134, 110,   6, 244, 120, 231, 163,
+                                      82, 243, 141,  55, 178,  33,  61, 216,   4,  54, 200, 242,  94, 206, 249, 104,
+                                      77,  48, 152,  27, 246,  72, 202, 102, 174,  56, 147,  90,  42, 128,  59, 249},
+    std::array<Uint8, blueNoiseSize>{ 82, 193, 163,   8, 208, 233,  98,   3, 239, 184,  78, 232,  49, 247,  72,  34,
+                                     239, 126, 189,  75, 132, 179,  49, 220,  16, 232, 159,  62, 178, 139,  16,  57,
+                                     116,  35, 199, 128, 222, 153, 119, 183,  86, 140, 176,  10, 147,  31,  61, 155,
+                                     230, 199,  84, 210, 114,   8, 144,  22, 252,  32, 209,  14, 243, 180,   4, 154},
+    std::array<Uint8, blueNoiseSize>{230,  49, 246,  64, 109,  44, 150, 201, 122,  39, 142, 170, 100,  19, 148, 111,
+                                     175,  14, 221,  42, 240,   3,  84, 119, 193,  38,  97, 207,  87,  45, 216, 191,
+                                     148, 224,  69,  99,  18,  83, 236,  23, 158, 220,  38, 118,  73, 218, 177,  24,
+                                     117,   3, 134, 178,  56, 236, 189,  82, 155, 126, 105, 165,  76, 109, 206, 135},
+    std::array<Uint8, blueNoiseSize>{100,  21, 124, 215, 172, 134, 250,  66,  89, 216,  13,  64, 193, 132, 219, 202,
+                                      58,  85, 115, 152, 100, 164, 208, 142,  66, 172, 248,  23, 147, 237, 101,  74,
+                                      25, 180,   7, 255, 170, 206,  41, 108, 250,  65, 100, 234, 195, 129,  91, 240,
+                                     191,  62, 255,  36,  94, 164, 119,  38, 223,  61, 236, 188,  51, 227,  31,  65},
+    std::array<Uint8, blueNoiseSize>{219, 185, 155,  34,  79,  10, 187,  24, 177, 158, 246, 114, 226,  43,  81,   1,
+                                     166, 252, 198,  25, 225,  59,  35, 242,  19, 110, 132,  54, 185,   1, 166, 133,
+                                     241, 107, 161, 124,  51, 141,  75, 197, 132,  12, 184, 150,  51,  15, 165,  45,
+                                     140, 103, 218, 153,  19, 226,  65, 204, 178,  11,  87,  27, 143, 121, 193, 163},
+    std::array<Uint8, blueNoiseSize>{112,   0,  90, 240, 198, 101,  52, 224, 106,  34, 135,  84,  26, 176, 244, 106,
+                                     135,  45, 144,  69, 187, 128, 174,  92, 154, 214, 196,  80, 223, 117,  38, 199,
+                                      58, 210,  35,  89, 217, 181,   5, 162,  50, 211,  82,  28, 253, 108, 222,  82,
+                                      12, 174,  75, 125, 196, 110,   6, 141,  96, 131, 212, 160, 254,   8,  84,  44},
+    std::array<Uint8, blueNoiseSize>{132, 225,  60, 146, 122, 232, 154, 128,  75, 210,  55, 199, 153, 123,  62, 191,
+                                      30, 214,  97,  14, 247, 107,   6, 222,  72,  45,  13, 103, 153,  66, 251,  92,
+                                      17, 145,  71, 237,  21, 112, 245,  93, 227, 114, 168, 128, 203,  68, 189, 147,
+                                     236, 208,  28,  52, 241,  84, 171, 250,  50, 232,  35, 106,  70, 209, 177, 245},
+    std::array<Uint8, blueNoiseSize>{ 72, 195, 169,  42,  22,  69, 204,  16, 253, 162,   5, 239,  95,  12, 225, 158,
+                                      79, 234, 182, 162,  82, 206,  52, 182, 136, 254, 164, 232,  28, 206, 171, 126,
+                                     189, 226, 175, 132, 194,  63, 138,  33, 186,  17, 242,  56, 157,   4, 119,  32,
+                                      59,  94, 159, 185, 138,  37, 206,  28, 155,  76, 175, 199,  47, 136,  97,  29},
+    std::array<Uint8, blueNoiseSize>{148,  13, 105, 249, 185,  94, 171,  45, 113, 190, 142,  68, 174, 204,  49, 131,
+                                      19, 112,  57, 126,  40, 143, 237, 111,  27,  96, 190, 122,  53, 139,   9,  79,
+                                      47, 111,   2,  94,  43, 159, 222,  80, 151,  66, 102,  35, 218,  95, 232, 181,
+                                     132, 251, 114,   2, 228,  67, 125,  98, 192, 115,   2, 147, 229,  17, 166, 212},
+    std::array<Uint8, blueNoiseSize>{ 55, 236,  80, 131, 215,   3, 141, 223,  82,  21, 100, 230,  29, 116,  86, 255,
+                                     168, 205,  10, 242, 190,  22,  74, 160, 201,  63,   4,  85, 177, 244, 104, 212,
+                                     238, 163,  65, 249, 209, 108,  11, 198, 126, 233, 173, 195, 139,  74, 166,  48,
+                                     199,  19,  72, 203, 102, 168, 244,  14, 217,  55, 248,  90, 121,  63, 241, 116},
+    std::array<Uint8, blueNoiseSize>{202, 178,  26, 162,  46, 115, 240,  62, 179, 207, 127,  51, 150, 219, 182,  34,
+                                      67, 149,  88, 217, 103, 170, 230,  38, 129, 243, 150, 225,  32,  68, 153,  21,
+                                     136,  34, 186, 144,  25, 169,  59, 253,  46,   1,  82, 118,  24, 250,  11, 108,
+                                      84, 161, 222, 148,  26,  53, 141,  81, 162, 132, 186,  30, 216, 191,  85,  37},
+    std::array<Uint8, blueNoiseSize>{ 91, 125, 228,  61, 195,  85, 159,  27, 137,  41, 242, 169,  77,  14, 136, 105,
+                                     236, 188,  48, 137,  62,   0, 119,  86, 216,  18, 109, 193, 132, 217, 182,  55,
+                                     201,  99, 231,  78, 116, 225,  89, 180, 106, 160, 203, 226,  49, 189, 149, 214,
+                                     236,  41, 120,  63, 177, 224, 199,  44, 233,  20,  72, 170,  48, 157,  12, 143},
+    std::array<Uint8, blueNoiseSize>{219,   5, 107, 144, 255,  12, 211, 107, 227,  90,   1, 111, 193, 246,  53, 207,
+                                       6, 120,  30, 178, 246, 151, 208, 185,  54, 173,  73,  41,  95,   8, 116, 243,
+                                      84, 127,   7,  49, 197, 134,  16, 145, 215,  31,  63, 144,  92, 115,  67,  30,
+                                     133, 182,  10, 248,  88, 112,   5, 122,  92, 205, 112, 231, 134, 101, 252, 170},
+    std::array<Uint8, blueNoiseSize>{ 47, 192,  76,  31, 176, 124,  71, 170,  53, 187, 153, 215,  33,  98, 161,  83,
+                                     146, 229,  96, 201,  78,  43,  99,  26, 136, 235, 156, 206, 249, 167,  76,  37,
+                                     160, 220, 181, 155, 244,  68,  39, 238,  75, 130, 232, 178,  17, 243, 168, 197,
+                                     100,  77, 205, 139,  31, 190, 159, 254, 181,  57, 152,   6,  79, 206,  24,  71},
+    std::array<Uint8, blueNoiseSize>{133, 157, 231, 208,  92,  44, 235, 143,  22, 247,  73, 132,  63, 180, 226,  23,
+                                     194,  66, 163,  20, 131, 224, 166, 250,  79,   5, 122,  59,  28, 144, 223, 196,
+                                      20,  62, 107,  29,  91, 172, 204,  98, 190,   8, 110,  42, 212, 127,  55,   2,
+                                     240,  48, 167, 106, 231,  51,  76,  19, 142,  32, 214, 246,  40, 184, 112, 236},
+    std::array<Uint8, blueNoiseSize>{ 94,  20, 115,  56, 152, 189,  15, 203,  97, 118,  36, 230,  10, 142, 110,  41,
+                                     129, 247,  50, 211, 103,   9,  64, 145, 111, 190, 228,  88, 181, 106,  51, 120,
+                                     141, 255, 194, 131, 222,   3, 118, 155,  50, 170, 251,  88, 157,  76, 226, 110,
+                                     142, 218,  23,  67, 152, 209, 128, 221, 102,  70, 169,  88, 127, 148,  55, 178},
+    std::array<Uint8, blueNoiseSize>{ 38, 247, 171,  10, 241, 107, 130,  64, 174, 213, 156, 194,  87, 253, 203,  77,
+                                     177,   2, 116, 150, 233, 174, 196,  33, 214,  51,  24, 135, 203,   6, 237,  85,
+                                     168,   9,  77,  40, 152,  61, 248,  26, 211,  71, 141, 205,  10, 184,  37, 163,
+                                      83, 185, 124, 246,   7,  86, 186,  43, 243, 199, 120,  18, 195, 226,   3, 212},
+    std::array<Uint8, blueNoiseSize>{125,  74, 201, 139,  67, 215,  29, 252,  83,   6,  56, 107, 167,  21,  58, 161,
+                                     235,  90, 192,  70,  40,  85, 121, 241,  93, 152, 172, 252,  62, 160, 210,  33,
+                                     186, 103, 204, 235,  97, 185, 140,  86, 231, 123,  30,  58, 108, 132, 201, 255,
+                                      14,  41, 213,  94, 171,  32, 113, 161,   0, 146,  48, 237,  64, 104,  81, 160},
+    std::array<Uint8, blueNoiseSize>{ 57, 223, 103,  35,  89, 177, 157,  46, 146, 227, 128, 238,  44, 137, 220, 120,
+                                      34, 137, 223,  24, 253, 134,  17,  59, 182,  14,  75, 112,  35,  97, 131,  68,
+                                     243,  51, 136, 164,  13, 213,  42, 113,  16, 166, 188, 221, 243,  25,  94,  64,
+                                     120, 156,  58, 194, 138, 238, 216,  66,  92, 224, 111, 176, 156,  33, 253, 192},
+    std::array<Uint8, blueNoiseSize>{145,   8, 164, 190, 238,   0, 102, 208, 189,  96,  31, 179,  80, 192,  99,  15,
+                                     188,  54, 157, 110, 180, 204, 162, 226, 106, 202, 130, 216, 185, 231,  20, 156,
+                                     117, 220,  26,  66, 123,  79, 239, 153, 200,  50,  88, 150,  72, 172, 143, 220,
+                                     182, 232, 109,  21,  75,  49, 131, 180,  28, 191,  77,  15, 207, 138, 113,  23},
+    std::array<Uint8, blueNoiseSize>{ 93, 244, 121,  51, 132, 217,  64, 122,  15,  66, 140, 213,  11, 247, 158,  69,
+                                     240,  83, 212,   9,  91,  46,  74, 141,  37, 238,  52,   2, 144,  81, 176, 214,
+                                       8,  86, 175, 250, 193,  30, 176,  63, 101, 250,   0, 120,  42, 214,  16,  49,
+                                      79,   6, 144, 250, 165, 201,  10, 101, 252, 136,  39, 243,  93,  53, 233, 172},
+    std::array<Uint8, blueNoiseSize>{ 35,  69, 205,  19,  82, 155,  37, 234, 172, 250, 160, 104,  59, 117,  36, 207,
+                                     130, 169,  42, 144, 241, 115, 214,   7, 171,  89, 158, 102, 241,  58,  37, 105,
+                                     141, 198,  44, 149, 104, 223, 126,  11, 209, 136, 182, 233,  96, 195, 127, 238,
+                                     163,  95, 209,  39,  88, 118, 233, 153,  54, 212, 165, 122, 183,   4,  76, 198},
+    std::array<Uint8, blueNoiseSize>{150, 227, 100, 175, 254, 191, 106, 138,  23,  86,  42, 194, 231, 148, 185,  89,
+                                       6, 112, 229,  66, 166,  26, 127, 249,  61, 188, 221,  32, 202, 119, 190, 253,
+                                      62, 227, 116,   2,  87,  53, 167, 235,  80,  32,  59, 167,  22, 155,  63, 107,
+                                     189,  27, 126, 183, 225,  20,  70, 174,  86,   8, 104,  64, 225, 142, 217, 123},
+    std::array<Uint8, blueNoiseSize>{ 55, 183,  28, 142,  54,   8, 226,  71, 199, 219, 127,   2,  79,  24, 224,  51,
+                                     255, 182,  29, 102, 205, 184,  80, 153, 109,  19, 133,  65, 147,   9, 161,  91,
+                                      19, 167,  73, 240, 159, 202,  20, 111, 149, 191, 101, 219,  78, 251,   5, 207,
+                                      44, 245,  69, 156,  56, 140, 196,  33, 126, 240, 197,  22, 157,  42,  98,  17},
+    std::array<Uint8, blueNoiseSize>{212, 112, 241,  78, 123, 168,  92, 152,  51, 110, 182, 244, 140, 176, 106, 133,
+                                     154,  73, 218, 149,   0,  56, 227,  41, 200, 231,  85, 175, 245,  76, 218, 129,
+                                      42, 188, 137, 210,  37, 129,  69, 211,  45, 243, 125,  27, 145, 115, 177,  83,
+                                     143, 117, 218,   4, 106, 249,  91, 217, 184,  46, 135, 234,  81, 193, 251, 167},
+    std::array<Uint8, blueNoiseSize>{ 85,   5, 162,  40, 222, 200,  32, 248,  13, 166,  64,  92,  39, 211,  65,  13,
+                                     204,  43, 121,  85, 244, 131,  96, 173,   9, 123,  45, 208,  23, 112,  52, 200,
+                                     235, 103,  15,  60, 180,  96, 254, 177,  88,   4, 163, 205,  49, 225,  32, 235,
+                                     165,  19,  80, 171, 207,  45, 159,  12, 111,  73, 169,  97,  31, 119,  62, 136},
+    std::array<Uint8, blueNoiseSize>{ 45, 234, 193, 101, 148,  61, 113, 188, 136, 233,  27, 217, 123, 162, 245,  99,
+                                     170, 236,  18, 162, 190,  35, 210, 142,  75, 254, 162,  97, 141, 228, 177,  26,
+                                     148,  78, 248, 120, 220,  12, 154,  30, 137, 229,  64,  95, 186,  72, 133,  99,
+                                      57, 186, 242, 135,  27, 124,  65, 226, 144, 255,   1, 210, 176, 219,  11, 189},
+    std::array<Uint8, blueNoiseSize>{154, 128,  71,  22, 246,   2, 213,  75,  40,  98, 147, 189,   6,  53, 193,  31,
+                                      78, 138, 197,  48, 113,  70, 235,  26, 109, 187,  29,  61, 192,   1,  89, 122,
+                                      56, 171, 199,  33, 143,  65, 226, 113,  53, 188, 118, 248,  17, 169, 213,  10,
+                                     201, 113,  38,  92, 194, 238, 179,  99,  29, 164,  63, 127,  48, 150, 106, 228},
+    std::array<Uint8, blueNoiseSize>{ 93,  29, 215, 174, 134,  87, 170, 122, 224, 181,  73, 250, 109,  84, 148, 118,
+                                     230,  60, 101, 251, 172,  13, 156, 198,  53, 151, 222, 126, 240,  71, 164, 244,
+                                     215,   7,  86, 161, 104, 191,  81, 165, 213,  12, 154,  37, 143, 109,  47, 254,
+                                     149,  73, 224, 158,  56,  16,  79, 208,  47, 196, 105, 231,  80, 248,  22,  67},
+    std::array<Uint8, blueNoiseSize>{181, 242, 115,  46, 197, 230,  34, 151,  11,  52, 133,  20, 159, 234, 205,  11,
+                                     181, 215,  16, 134,  84, 224, 119,  93, 239,   6,  86, 173,  43, 110, 201,  36,
+                                     140, 112, 229,  50, 242,   1,  40, 247,  98,  70, 200,  87, 224, 193,  83, 127,
+                                      33, 174,   1, 205, 115, 149, 170, 121, 245, 138,  17, 186,  34, 134, 167, 208},
+    std::array<Uint8, blueNoiseSize>{  7,  58, 156,  81,  16, 108,  58, 255, 202, 114, 228, 197,  63,  30, 135,  49,
+                                      90, 152,  39, 204,  58, 184,  41, 137,  67, 207, 116,  23, 213, 137,  16,  95,
+                                      62, 186,  21, 129, 173, 206, 117, 141,  21, 172, 240, 130,  57,   5, 162, 219,
+                                     104, 237, 135,  70, 249,  36, 221,   5,  91,  71, 223, 153,  92, 198,  50, 117},
+    std::array<Uint8, blueNoiseSize>{145, 102, 203, 247, 129, 165, 186,  93,  71, 169,  39,  92, 177, 220,  73, 253,
+                                     115, 173, 240, 112, 150,   7, 249, 163,  20, 183, 146, 251,  60, 156, 232, 174,
+                                     254, 149, 210,  71,  91, 151,  60, 195, 229,  49, 111,  25, 176, 245,  66,  20,
+                                     184,  50,  96,  23, 184, 104,  58, 145, 187,  35, 171, 119,   4, 243,  76, 232},
+    std::array<Uint8, blueNoiseSize>{216,  39, 170,  25,  69, 221,   6, 143,  25, 239, 148,   1, 125, 103, 157, 188,
+                                       5,  62,  81,  22, 218, 100, 194,  82, 234, 103,  37,  77, 194, 101,  45,  81,
+                                       9,  99,  43, 235,  30, 219,  15,  85, 127, 160,  80, 206, 146,  95, 122, 208,
+                                      79, 155, 200, 230, 143,  78, 204, 232, 111, 239,  60, 207,  45, 104, 158,  27},
+    std::array<Uint8, blueNoiseSize>{ 68, 125,  90, 231, 148,  48, 199, 124, 218, 108,  56, 207, 246,  44,  21, 217,
+                                     125, 233, 196, 137, 171,  70,  32, 127,  52, 218, 168, 133,  12, 222, 124, 209,
+                                     189, 133, 169, 120, 187, 101, 252, 176,  35, 220,  10, 237,  43, 198,  29, 139,
+                                     248,   7, 121,  43, 167,  13, 129,  30, 164,  10,  87, 135, 183, 225, 132, 191},
+    std::array<Uint8, blueNoiseSize>{251, 182,   2, 190, 114,  95, 246,  80,  43, 193, 166,  76, 140, 182,  88,  57,
+                                     146,  31,  93,  47, 246, 118, 228, 154, 203,   4,  93, 240, 181,  33, 164,  58,
+                                      25, 240,  64,   4, 158,  50, 145, 116,  68, 192, 101, 136,  73, 169, 233,  54,
+                                     108, 176,  68, 211,  90, 254, 180,  53,  98, 213, 154, 252,  24,  63,  11,  94}
+};
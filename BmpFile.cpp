@@ -0,0 +1,176 @@
+#include "BmpFile.hpp"
+#include <ostream>
+#include <stdexcept>
+
+namespace
+{
+// Run length encoding packs two pixels to a byte
+using Rle4Format = IndexedFormat<4>;
+
+constexpr size_t fileHeaderSize{14};
+constexpr size_t infoHeaderSize{40};
+// 72 DPI
+constexpr Uint32 pixelsPerMeter{2835};
+constexpr Uint32 biRgb{0};
+constexpr Uint32 biRle4{2};
+constexpr size_t maxRun{255};
+// Shorter runs of a repeated pair stay inside an absolute run, ending it early would cost more than it saves
+constexpr size_t minEncodedRun{6};
+
+void writeValue(std::vector<Uint8>& output, const size_t offset, const Uint32 value, const size_t size = 4)
+{
+    for (size_t i{0}; i < size; ++i)
+    {
+        output[offset + i] = static_cast<Uint8>(value >> 8 * i);
+    }
+}
+
+// Pixels from position on that alternate between its first two, as an encoded run can repeat them
+size_t getEncodedRun(const Uint8* pixels, const size_t position, const size_t count, const size_t limit)
+{
+    size_t run{1};
+    while (run < limit and position + run < count and pixels[position + run] == pixels[position + run % 2])
+    {
+        ++run;
+    }
+    return run;
+}
+
+void appendEncodedRun(std::vector<Uint8>& output, const Uint8* pixels, const size_t run)
+{
+    output.push_back(static_cast<Uint8>(run));
+    output.push_back(static_cast<Uint8>(pixels[0] << 4 | (run > 1 ? pixels[1] : 0)));
+}
+
+void appendRle4Row(std::vector<Uint8>& output, const Uint8* pixels, const size_t count)
+{
+    size_t position{0};
+    while (position < count)
+    {
+        const size_t run = getEncodedRun(pixels, position, count, maxRun);
+        if (run >= minEncodedRun)
+        {
+            appendEncodedRun(output, pixels + position, run);
+            position += run;
+            continue;
+        }
+
+        const size_t start = position;
+        while (position < count and position - start < maxRun and getEncodedRun(pixels, position, count, minEncodedRun) < minEncodedRun)
+        {
+            ++position;
+        }
+
+        // Absolute runs hold at least three pixels, shorter ones fit an encoded run of any two pixels
+        const size_t literals = position - start;
+        if (literals < 3)
+        {
+            appendEncodedRun(output, pixels + start, literals);
+            continue;
+        }
+
+        output.push_back(0);
+        output.push_back(static_cast<Uint8>(literals));
+        const size_t bytes = (literals + 1) / 2;
+        const size_t offset = output.size();
+        output.resize(offset + bytes + bytes % 2);
+        Rle4Format::pack(pixels + start, literals, output.data() + offset);
+    }
+
+    // End of line
+    output.push_back(0);
+    output.push_back(0);
+}
+}
+
+template <unsigned Bits>
+void writeBmpFile(std::ostream& stream, const IndexedImage<Bits>& image, const BmpCompression compression)
+{
+    using Format = IndexedFormat<Bits>;
+    static_assert(Bits == 1 or Bits == 4 or Bits == 8, "Bitmaps have no other paletted depths");
+
+    if (compression == BmpCompression::rle4 and Bits != 4)
+    {
+        throw std::runtime_error("RLE4 compression needs 4 bits per pixel");
+    }
+
+    constexpr size_t dataOffset{fileHeaderSize + infoHeaderSize + Format::paletteSize * 4};
+    const size_t width = image.lines;
+    const size_t height = image.length;
+    const size_t lineSize = Format::packedSize(height);
+
+    std::vector<Uint8> pixels(width * height);
+    for (size_t x{0}; x < width; ++x)
+    {
+        Format::unpack(image.indices.data() + x * lineSize, height, pixels.data() + x * height);
+    }
+
+    std::vector<Uint8> output(dataOffset);
+    const size_t rowSize = (Format::packedSize(width) + 3) / 4 * 4;
+    if (compression == BmpCompression::none)
+    {
+        output.reserve(dataOffset + rowSize * height);
+    }
+
+    // Rows are stored bottom up
+    std::vector<Uint8> row(width);
+    for (size_t y{height}; y-- > 0;)
+    {
+        for (size_t x{0}; x < width; ++x)
+        {
+            row[x] = pixels[x * height + y];
+        }
+
+        if (compression == BmpCompression::rle4)
+        {
+            appendRle4Row(output, row.data(), width);
+        }
+        else
+        {
+            const size_t offset = output.size();
+            output.resize(offset + rowSize);
+            Format::pack(row.data(), width, output.data() + offset);
+        }
+    }
+
+    if (compression == BmpCompression::rle4)
+    {
+        // End of bitmap
+        output.push_back(0);
+        output.push_back(1);
+    }
+
+    output[0] = 'B';
+    output[1] = 'M';
+    writeValue(output, 2, static_cast<Uint32>(output.size()));
+    writeValue(output, 10, static_cast<Uint32>(dataOffset));
+
+    writeValue(output, 14, static_cast<Uint32>(infoHeaderSize));
+    writeValue(output, 18, static_cast<Uint32>(width));
+    writeValue(output, 22, static_cast<Uint32>(height));
+    writeValue(output, 26, 1, 2);
+    writeValue(output, 28, Format::bits, 2);
+    writeValue(output, 30, compression == BmpCompression::rle4 ? biRle4 : biRgb);
+    writeValue(output, 34, static_cast<Uint32>(output.size() - dataOffset));
+    writeValue(output, 38, pixelsPerMeter);
+    writeValue(output, 42, pixelsPerMeter);
+    writeValue(output, 46, static_cast<Uint32>(Format::paletteSize));
+
+    for (size_t i{0}; i < Format::paletteSize; ++i)
+    {
+        const SDL_Color& color = image.palette[i];
+        const size_t offset = fileHeaderSize + infoHeaderSize + i * 4;
+        output[offset] = color.b;
+        output[offset + 1] = color.g;
+        output[offset + 2] = color.r;
+    }
+
+    if (not stream.write(reinterpret_cast<const char*>(output.data()), static_cast<std::streamsize>(output.size())))
+    {
+        throw std::runtime_error("Failed to write bmp file");
+    }
+}
+
+template void writeBmpFile<1>(std::ostream&, const IndexedImage<1>&, BmpCompression);
+template void writeBmpFile<4>(std::ostream&, const IndexedImage<4>&, BmpCompression);
+template void writeBmpFile<8>(std::ostream&, const IndexedImage<8>&, BmpCompression);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <iosfwd>
+#include "IndexedFormat.hpp"
+
+enum class BmpCompression
+{
+    none,
+    rle4,
+};
+
+// Paletted bitmap of 1, 4 or 8 bits per pixel, stored as BI_RGB, or as BI_RLE4 at 4 bits. Image lines become the
+// columns of the bitmap, as they are in Image. The whole file is built in memory and written at once.
+template <unsigned Bits>
+void writeBmpFile(std::ostream&, const IndexedImage<Bits>&, BmpCompression = BmpCompression::none);
@@ -0,0 +1,7 @@
+#include "ColorIndexCache.hpp"
+
+ColorIndexCache::ColorIndexCache() : frontEntries(size_t{1} << frontBits, FrontEntry{emptyKey, 0}),
+    keys(size_t{1} << tableBits, emptyKey),
+    indices(size_t{1} << tableBits),
+    colorsCount{0}
+{}
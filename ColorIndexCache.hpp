@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <SDL2/SDL.h>
+
+// Memo of the palette index found for each color, always in front of the nearest palette search. It records the
+// first maxColors distinct colors it sees and then stops recording: later colors are searched every time, apart from
+// runs of one color, which a small direct mapped cache in front of the table still catches.
+class ColorIndexCache
+{
+public:
+    static constexpr size_t maxColors{4096};
+
+    ColorIndexCache();
+
+    template <typename Search>
+    size_t find(const SDL_Color& color, Search&& search)
+    {
+        const Uint32 key = getKey(color);
+
+        FrontEntry& front = frontEntries[(key * hashMultiplier) >> (32 - frontBits)];
+        if (front.key == key)
+        {
+            return front.index;
+        }
+
+        size_t index{};
+        if (colorsCount == maxColors)
+        {
+            index = search(color);
+        }
+        else
+        {
+            size_t slot = (key * hashMultiplier) >> (32 - tableBits);
+            while (keys[slot] != key and keys[slot] != emptyKey)
+            {
+                slot = (slot + 1) & (keys.size() - 1);
+            }
+
+            if (keys[slot] == emptyKey)
+            {
+                keys[slot] = key;
+                indices[slot] = static_cast<Uint8>(search(color));
+                ++colorsCount;
+            }
+            index = indices[slot];
+        }
+
+        front = FrontEntry{key, static_cast<Uint8>(index)};
+        return index;
+    }
+
+private:
+    struct FrontEntry
+    {
+        Uint32 key;
+        Uint8 index;
+    };
+
+    static constexpr unsigned frontBits{8};
+    // Twice maxColors keeps the load factor at most one half
+    static constexpr unsigned tableBits{13};
+    static constexpr Uint32 hashMultiplier{2654435761u};
+    static constexpr Uint32 emptyKey{0};
+
+    std::vector<FrontEntry> frontEntries;
+    std::vector<Uint32> keys;
+    std::vector<Uint8> indices;
+    size_t colorsCount;
+
+    // The top byte is set so that no color maps to emptyKey
+    static Uint32 getKey(const SDL_Color& color)
+    {
+        return 0x01000000u | static_cast<Uint32>(color.r) << 16 | static_cast<Uint32>(color.g) << 8 | color.b;
+    }
+};
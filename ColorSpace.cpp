@@ -0,0 +1,338 @@
+#include "ColorSpace.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+using Matrix = std::array<std::array<double, 3>, 3>;
+
+// Linear sRGB to CIE XYZ under D65, each row divided by the white point so that white maps to (1, 1, 1)
+constexpr Matrix linearToXyz{
+    std::array<double, 3>{0.4124564 / 0.95047, 0.3575761 / 0.95047, 0.1804375 / 0.95047},
+    std::array<double, 3>{0.2126729, 0.7151522, 0.0721750},
+    std::array<double, 3>{0.0193339 / 1.08883, 0.1191920 / 1.08883, 0.9503041 / 1.08883}
+};
+
+constexpr Matrix xyzToLinear{
+    std::array<double, 3>{3.2404542 * 0.95047, -1.5371385, -0.4985314 * 1.08883},
+    std::array<double, 3>{-0.9692660 * 0.95047, 1.8760108, 0.0415560 * 1.08883},
+    std::array<double, 3>{0.0556434 * 0.95047, -0.2040259, 1.0572252 * 1.08883}
+};
+
+constexpr Matrix linearToLms{
+    std::array<double, 3>{0.4122214708, 0.5363325363, 0.0514459929},
+    std::array<double, 3>{0.2119034982, 0.6806995451, 0.1073969566},
+    std::array<double, 3>{0.0883024619, 0.2817188376, 0.6299787005}
+};
+
+constexpr Matrix lmsToOklab{
+    std::array<double, 3>{0.2104542553, 0.7936177850, -0.0040720468},
+    std::array<double, 3>{1.9779984951, -2.4285922050, 0.4505937099},
+    std::array<double, 3>{0.0259040371, 0.7827717662, -0.8086757660}
+};
+
+constexpr Matrix oklabToLms{
+    std::array<double, 3>{1.0, 0.3963377774, 0.2158037573},
+    std::array<double, 3>{1.0, -0.1055613458, -0.0638541728},
+    std::array<double, 3>{1.0, -0.0894841775, -1.2914855480}
+};
+
+constexpr Matrix lmsToLinear{
+    std::array<double, 3>{4.0767416621, -3.3077115913, 0.2309699292},
+    std::array<double, 3>{-1.2684380046, 2.6097574011, -0.3413193965},
+    std::array<double, 3>{-0.0041960863, -0.7034186147, 1.7076147010}
+};
+
+constexpr int matrixShift = 14;
+constexpr int compressedShift = 12;
+constexpr double labEpsilon = 6.0 / 29.0;
+
+std::array<double, 3> multiply(const Matrix& matrix, const std::array<double, 3>& vector)
+{
+    std::array<double, 3> result{};
+    for (size_t i{0}; i < 3; ++i)
+    {
+        result[i] = matrix[i][0] * vector[0] + matrix[i][1] * vector[1] + matrix[i][2] * vector[2];
+    }
+    return result;
+}
+
+Uint8 linearToSrgb(const double value)
+{
+    const double clamped = std::clamp(value, 0.0, 1.0);
+    const double encoded = clamped <= 0.0031308 ? 12.92 * clamped : 1.055 * std::pow(clamped, 1.0 / 2.4) - 0.055;
+    return static_cast<Uint8>(std::lround(encoded * 255.0));
+}
+
+template <typename Function>
+std::vector<int16_t> makeCompression(Function function)
+{
+    std::vector<int16_t> table(65536);
+    for (size_t i{0}; i < table.size(); ++i)
+    {
+        table[i] = static_cast<int16_t>(std::lround(function(i / 65535.0) * (1 << compressedShift)));
+    }
+    return table;
+}
+
+const std::vector<int16_t>& getLabCompression()
+{
+    static const std::vector<int16_t> table = makeCompression([](const double t)
+                                                                  {
+                                                                      return t > labEpsilon * labEpsilon * labEpsilon
+                                                                                 ? std::cbrt(t)
+                                                                                 : t / (3.0 * labEpsilon * labEpsilon) + 4.0 / 29.0;
+                                                                  });
+    return table;
+}
+
+const std::vector<int16_t>& getCubeRoot()
+{
+    static const std::vector<int16_t> table = makeCompression([](const double t)
+                                                                  {
+                                                                      return std::cbrt(t);
+                                                                  });
+    return table;
+}
+
+std::array<std::array<int32_t, 3>, 3> toFixedPoint(const Matrix& matrix)
+{
+    std::array<std::array<int32_t, 3>, 3> result{};
+    for (size_t i{0}; i < 3; ++i)
+    {
+        for (size_t j{0}; j < 3; ++j)
+        {
+            result[i][j] = static_cast<int32_t>(std::lround(matrix[i][j] * (1 << matrixShift)));
+        }
+    }
+    return result;
+}
+
+const std::array<std::array<int32_t, 3>, 3> linearToXyzFixed = toFixedPoint(linearToXyz);
+const std::array<std::array<int32_t, 3>, 3> linearToLmsFixed = toFixedPoint(linearToLms);
+
+int32_t toIndex(const std::array<int32_t, 3>& row, const int32_t r, const int32_t g, const int32_t b)
+{
+    return std::clamp((row[0] * r + row[1] * g + row[2] * b + (1 << (matrixShift - 1))) >> matrixShift, 0, 65535);
+}
+}
+
+const std::array<Uint16, 256>& getSrgbToLinearTable()
+{
+    static const std::array<Uint16, 256> table = []
+    {
+        std::array<Uint16, 256> result{};
+        for (size_t i{0}; i < result.size(); ++i)
+        {
+            const double encoded = i / 255.0;
+            const double linear = encoded <= 0.04045 ? encoded / 12.92 : std::pow((encoded + 0.055) / 1.055, 2.4);
+            result[i] = static_cast<Uint16>(std::lround(linear * 65535.0));
+        }
+        return result;
+    }();
+    return table;
+}
+
+const std::array<Uint8, 4096>& getLinearToSrgbTable()
+{
+    static const std::array<Uint8, 4096> table = []
+    {
+        std::array<Uint8, 4096> result{};
+        for (size_t i{0}; i < result.size(); ++i)
+        {
+            result[i] = linearToSrgb((i * 16.0 + 8.0) / 65535.0);
+        }
+        return result;
+    }();
+    return table;
+}
+
+ColorConverter::ColorConverter(const ColorMetric metric) : metric{metric},
+    compression{nullptr}
+{
+    switch (metric)
+    {
+        case ColorMetric::rgb:
+            break;
+        case ColorMetric::cielab:
+            compression = &getLabCompression();
+            break;
+        case ColorMetric::oklab:
+            compression = &getCubeRoot();
+            break;
+    }
+}
+
+ColorMetric ColorConverter::getMetric() const
+{
+    return metric;
+}
+
+MetricColor ColorConverter::convert(const SDL_Color& color) const
+{
+    if (metric == ColorMetric::rgb)
+    {
+        return MetricColor{color.r, color.g, color.b};
+    }
+
+    const auto& linear = getSrgbToLinearTable();
+    const int32_t r = linear[color.r];
+    const int32_t g = linear[color.g];
+    const int32_t b = linear[color.b];
+
+    const auto& rows = metric == ColorMetric::cielab ? linearToXyzFixed : linearToLmsFixed;
+    const int32_t x = (*compression)[toIndex(rows[0], r, g, b)];
+    const int32_t y = (*compression)[toIndex(rows[1], r, g, b)];
+    const int32_t z = (*compression)[toIndex(rows[2], r, g, b)];
+
+    if (metric == ColorMetric::cielab)
+    {
+        // L = 116 fy - 16, a = 500 (fx - fy), b = 200 (fy - fz), all scaled by 16
+        return MetricColor{
+            static_cast<int16_t>(116 * 16 * y / (1 << compressedShift) - 16 * 16),
+            static_cast<int16_t>(500 * 16 * (x - y) / (1 << compressedShift)),
+            static_cast<int16_t>(200 * 16 * (y - z) / (1 << compressedShift))
+        };
+    }
+
+    static const auto lmsToOklabFixed = toFixedPoint(lmsToOklab);
+    MetricColor result{};
+    for (size_t i{0}; i < 3; ++i)
+    {
+        result[i] = static_cast<int16_t>((lmsToOklabFixed[i][0] * x + lmsToOklabFixed[i][1] * y + lmsToOklabFixed[i][2] * z) / (1 << matrixShift));
+    }
+    return result;
+}
+
+SDL_Color ColorConverter::toSdlColor(const std::array<double, 3>& coordinates) const
+{
+    std::array<double, 3> linear{};
+
+    switch (metric)
+    {
+        case ColorMetric::rgb:
+            return SDL_Color{
+                static_cast<Uint8>(std::clamp(std::lround(coordinates[0]), 0l, 255l)),
+                static_cast<Uint8>(std::clamp(std::lround(coordinates[1]), 0l, 255l)),
+                static_cast<Uint8>(std::clamp(std::lround(coordinates[2]), 0l, 255l)),
+                1
+            };
+
+        case ColorMetric::cielab:
+        {
+            const auto inverse = [](const double t)
+            {
+                return t > labEpsilon ? t * t * t : 3.0 * labEpsilon * labEpsilon * (t - 4.0 / 29.0);
+            };
+
+            const double fy = (coordinates[0] / 16.0 + 16.0) / 116.0;
+            const double fx = fy + coordinates[1] / 16.0 / 500.0;
+            const double fz = fy - coordinates[2] / 16.0 / 200.0;
+            linear = multiply(xyzToLinear, {inverse(fx), inverse(fy), inverse(fz)});
+            break;
+        }
+
+        case ColorMetric::oklab:
+        {
+            const double scale = 1 << compressedShift;
+            auto lms = multiply(oklabToLms, {coordinates[0] / scale, coordinates[1] / scale, coordinates[2] / scale});
+            for (auto& value : lms)
+            {
+                value = value * value * value;
+            }
+            linear = multiply(lmsToLinear, lms);
+            break;
+        }
+    }
+
+    return SDL_Color{linearToSrgb(linear[0]), linearToSrgb(linear[1]), linearToSrgb(linear[2]), 1};
+}
+
+PaletteSearch::PaletteSearch(const SDL_Color* palette, const size_t size, const ColorConverter& converter) : size{size}
+{
+    // Padding entries are far enough to never be the nearest
+    constexpr float far{1.0e6f};
+    const size_t padded = (size + 3) / 4 * 4;
+
+    xs.assign(padded, far);
+    ys.assign(padded, far);
+    zs.assign(padded, far);
+
+    for (size_t i{0}; i < size; ++i)
+    {
+        const MetricColor color = converter.convert(palette[i]);
+        xs[i] = color[0];
+        ys[i] = color[1];
+        zs[i] = color[2];
+    }
+}
+
+size_t PaletteSearch::find(const MetricColor& color) const
+{
+    const float x = color[0];
+    const float y = color[1];
+    const float z = color[2];
+
+#if defined(__SSE2__)
+    const __m128 pointX = _mm_set1_ps(x);
+    const __m128 pointY = _mm_set1_ps(y);
+    const __m128 pointZ = _mm_set1_ps(z);
+    const __m128i step = _mm_set1_epi32(4);
+
+    __m128 best = _mm_set1_ps(FLT_MAX);
+    __m128i bestIndex = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+
+    for (size_t i{0}; i < xs.size(); i += 4)
+    {
+        const __m128 differenceX = _mm_sub_ps(_mm_loadu_ps(xs.data() + i), pointX);
+        const __m128 differenceY = _mm_sub_ps(_mm_loadu_ps(ys.data() + i), pointY);
+        const __m128 differenceZ = _mm_sub_ps(_mm_loadu_ps(zs.data() + i), pointZ);
+        const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(differenceX, differenceX), _mm_mul_ps(differenceY, differenceY)),
+                                           _mm_mul_ps(differenceZ, differenceZ));
+
+        const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+        best = _mm_min_ps(distance, best);
+        bestIndex = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, bestIndex));
+        index = _mm_add_epi32(index, step);
+    }
+
+    alignas(16) float distances[4];
+    alignas(16) int32_t indices[4];
+    _mm_store_ps(distances, best);
+    _mm_store_si128(reinterpret_cast<__m128i*>(indices), bestIndex);
+
+    size_t minimumIndex = static_cast<size_t>(indices[0]);
+    float minimum = distances[0];
+    for (size_t lane{1}; lane < 4; ++lane)
+    {
+        if (distances[lane] < minimum or (distances[lane] == minimum and static_cast<size_t>(indices[lane]) < minimumIndex))
+        {
+            minimum = distances[lane];
+            minimumIndex = static_cast<size_t>(indices[lane]);
+        }
+    }
+    return minimumIndex;
+#else
+    float minimum{FLT_MAX};
+    size_t minimumIndex{};
+
+    for (size_t i{0}; i < size; ++i)
+    {
+        const float differenceX = xs[i] - x;
+        const float differenceY = ys[i] - y;
+        const float differenceZ = zs[i] - z;
+
+        if (const float distance = differenceX * differenceX + differenceY * differenceY + differenceZ * differenceZ; distance < minimum)
+        {
+            minimum = distance;
+            minimumIndex = i;
+        }
+    }
+    return minimumIndex;
+#endif
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <SDL2/SDL.h>
+
+enum class ColorMetric
+{
+    rgb,
+    cielab,
+    oklab,
+};
+
+// Coordinates of a color in the space of a metric, in fixed point: RGB as is, CIELAB L*a*b* in 1/16 units and
+// OKLab in 1/4096 units. Squared euclidean distance between them is the metric (delta E76 for CIELAB).
+using MetricColor = std::array<int16_t, 3>;
+
+// sRGB transfer function as a table of linear light in 1/65535 units
+const std::array<Uint16, 256>& getSrgbToLinearTable();
+// Its inverse, indexed by linear light in 1/4096 units (linear >> 4)
+const std::array<Uint8, 4096>& getLinearToSrgbTable();
+
+// Rec. 709 luminance of linear light channels, weights in 1/65536 units
+inline constexpr std::array<Uint32, 3> linearLumaWeights{13933, 46871, 4732};
+
+// sRGB encoded luminance of a color, computed in linear light
+inline Uint8 getLinearLuma(const SDL_Color& color, const std::array<Uint16, 256>& toLinear, const std::array<Uint8, 4096>& toSrgb)
+{
+    const Uint32 luma = linearLumaWeights[0] * toLinear[color.r] + linearLumaWeights[1] * toLinear[color.g] + linearLumaWeights[2] * toLinear[color.b];
+    return toSrgb[luma >> 20];
+}
+
+class ColorConverter
+{
+public:
+    explicit ColorConverter(ColorMetric);
+
+    ColorMetric getMetric() const;
+
+    // Table driven and integer only
+    MetricColor convert(const SDL_Color&) const;
+    // Floating point inverse, meant for palette entries
+    SDL_Color toSdlColor(const std::array<double, 3>&) const;
+
+private:
+    ColorMetric metric;
+    // Nonlinear step of the metric indexed by linear light in 1/65535 units, result in 1/4096 units
+    const std::vector<int16_t>* compression;
+};
+
+// Nearest palette entry under a metric. Entries are kept as structure of arrays padded to a multiple of four,
+// so that four distances are compared per SSE instruction.
+class PaletteSearch
+{
+public:
+    PaletteSearch(const SDL_Color* palette, size_t size, const ColorConverter&);
+
+    size_t find(const MetricColor&) const;
+
+private:
+    size_t size;
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<float> zs;
+};
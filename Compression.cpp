@@ -0,0 +1,276 @@
+#include "Compression.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+constexpr size_t maxRun{128};
+constexpr size_t minMatch{4};
+constexpr size_t maxOffset{65535};
+constexpr unsigned hashBits{12};
+constexpr size_t noPosition{static_cast<size_t>(-1)};
+
+Uint32 read32(const Uint8* data)
+{
+    Uint32 value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Lengths that do not fit a token nibble continue in bytes of 255 and a final smaller byte
+void writeLength(std::vector<Uint8>& output, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        output.push_back(255);
+    }
+    output.push_back(static_cast<Uint8>(length));
+}
+
+size_t readLength(const Uint8* data, const size_t size, size_t& position)
+{
+    size_t length{0};
+    Uint8 byte;
+    do
+    {
+        if (position >= size)
+        {
+            throw std::runtime_error("Truncated LZ length");
+        }
+        byte = data[position++];
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+void writeSequence(std::vector<Uint8>& output, const Uint8* literals, const size_t literalsCount, const size_t offset, const size_t matchLength)
+{
+    const size_t matchCode = matchLength == 0 ? 0 : matchLength - minMatch;
+    output.push_back(static_cast<Uint8>((literalsCount < 15 ? literalsCount : 15) << 4 | (matchCode < 15 ? matchCode : 15)));
+
+    if (literalsCount >= 15)
+    {
+        writeLength(output, literalsCount - 15);
+    }
+    output.insert(output.end(), literals, literals + literalsCount);
+
+    if (matchLength == 0)
+    {
+        return;
+    }
+
+    output.push_back(static_cast<Uint8>(offset));
+    output.push_back(static_cast<Uint8>(offset >> 8));
+    if (matchCode >= 15)
+    {
+        writeLength(output, matchCode - 15);
+    }
+}
+}
+
+std::vector<Uint8> packBits(const Uint8* data, const size_t size)
+{
+    std::vector<Uint8> output;
+    output.reserve(size + size / maxRun + 1);
+
+    size_t i{0};
+    while (i < size)
+    {
+        size_t run{1};
+        while (i + run < size and run < maxRun and data[i + run] == data[i])
+        {
+            ++run;
+        }
+
+        // Runs of two stay literal, a separate run header would not save anything
+        if (run >= 3)
+        {
+            output.push_back(static_cast<Uint8>(1 - static_cast<int>(run)));
+            output.push_back(data[i]);
+            i += run;
+            continue;
+        }
+
+        const size_t start = i;
+        while (i < size and i - start < maxRun and not (i + 2 < size and data[i] == data[i + 1] and data[i] == data[i + 2]))
+        {
+            ++i;
+        }
+        output.push_back(static_cast<Uint8>(i - start - 1));
+        output.insert(output.end(), data + start, data + i);
+    }
+
+    return output;
+}
+
+std::vector<Uint8> unpackBits(const Uint8* data, const size_t size, const size_t unpackedSize)
+{
+    std::vector<Uint8> output(unpackedSize);
+    size_t written{0};
+
+    size_t i{0};
+    while (i < size)
+    {
+        const int header = static_cast<Sint8>(data[i++]);
+
+        if (header >= 0)
+        {
+            const size_t count = static_cast<size_t>(header) + 1;
+            if (i + count > size or written + count > unpackedSize)
+            {
+                throw std::runtime_error("Corrupt PackBits literal");
+            }
+            std::memcpy(output.data() + written, data + i, count);
+            i += count;
+            written += count;
+        }
+        else if (header != -128)
+        {
+            const size_t count = static_cast<size_t>(1 - header);
+            if (i >= size or written + count > unpackedSize)
+            {
+                throw std::runtime_error("Corrupt PackBits run");
+            }
+            std::memset(output.data() + written, data[i++], count);
+            written += count;
+        }
+    }
+
+    if (written != unpackedSize)
+    {
+        throw std::runtime_error("PackBits data ends early");
+    }
+    return output;
+}
+
+std::vector<Uint8> compressLz(const Uint8* data, const size_t size)
+{
+    std::vector<Uint8> output;
+    output.reserve(size + size / 255 + 16);
+
+    std::vector<size_t> positions(size_t{1} << hashBits, noPosition);
+    size_t anchor{0};
+    size_t i{0};
+
+    while (i + minMatch <= size)
+    {
+        const Uint32 sequence = read32(data + i);
+        const size_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+        const size_t candidate = positions[hash];
+        positions[hash] = i;
+
+        if (candidate == noPosition or i - candidate > maxOffset or read32(data + candidate) != sequence)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t length{minMatch};
+        while (i + length < size and data[candidate + length] == data[i + length])
+        {
+            ++length;
+        }
+
+        writeSequence(output, data + anchor, i - anchor, i - candidate, length);
+        i += length;
+        anchor = i;
+    }
+
+    // The last sequence has literals only, the decoder recognises it by running out of input after them
+    writeSequence(output, data + anchor, size - anchor, 0, 0);
+    return output;
+}
+
+std::vector<Uint8> decompressLz(const Uint8* data, const size_t size, const size_t decompressedSize)
+{
+    std::vector<Uint8> output(decompressedSize);
+    size_t written{0};
+    size_t i{0};
+
+    while (i < size)
+    {
+        const Uint8 token = data[i++];
+
+        size_t literalsCount = token >> 4;
+        if (literalsCount == 15)
+        {
+            literalsCount += readLength(data, size, i);
+        }
+        if (i + literalsCount > size or written + literalsCount > decompressedSize)
+        {
+            throw std::runtime_error("Corrupt LZ literals");
+        }
+        std::memcpy(output.data() + written, data + i, literalsCount);
+        i += literalsCount;
+        written += literalsCount;
+
+        if (i == size)
+        {
+            break;
+        }
+
+        if (i + 2 > size)
+        {
+            throw std::runtime_error("Truncated LZ offset");
+        }
+        const size_t offset = data[i] | data[i + 1] << 8;
+        i += 2;
+
+        size_t length = (token & 15) + minMatch;
+        if ((token & 15) == 15)
+        {
+            length += readLength(data, size, i);
+        }
+        if (offset == 0 or offset > written or written + length > decompressedSize)
+        {
+            throw std::runtime_error("Corrupt LZ match");
+        }
+
+        // Matches may overlap the bytes they produce, so they are copied forwards one byte at a time
+        for (size_t j{0}; j < length; ++j, ++written)
+        {
+            output[written] = output[written - offset];
+        }
+    }
+
+    if (written != decompressedSize)
+    {
+        throw std::runtime_error("LZ data ends early");
+    }
+    return output;
+}
+
+Chunk compressChunk(const Uint8* data, const size_t size)
+{
+    Chunk best{Codec::stored, std::vector<Uint8>(data, data + size)};
+
+    if (auto packed = packBits(data, size); packed.size() < best.data.size())
+    {
+        best = Chunk{Codec::packBits, std::move(packed)};
+    }
+    if (auto compressed = compressLz(data, size); compressed.size() < best.data.size())
+    {
+        best = Chunk{Codec::lz, std::move(compressed)};
+    }
+
+    return best;
+}
+
+std::vector<Uint8> decompressChunk(const Chunk& chunk, const size_t decompressedSize)
+{
+    switch (chunk.codec)
+    {
+        case Codec::stored:
+            if (chunk.data.size() != decompressedSize)
+            {
+                throw std::runtime_error("Stored chunk has a wrong size");
+            }
+            return chunk.data;
+        case Codec::packBits:
+            return unpackBits(chunk.data.data(), chunk.data.size(), decompressedSize);
+        case Codec::lz:
+            return decompressLz(chunk.data.data(), chunk.data.size(), decompressedSize);
+        default:
+            throw std::runtime_error("Unknown chunk codec");
+    }
+}
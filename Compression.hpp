@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <SDL2/SDL.h>
+
+// Byte oriented codecs for chunks of packed palette indices. Decoders throw std::runtime_error on input that does not
+// decode to exactly the expected size.
+
+// PackBits run length coding, which suits flat images
+std::vector<Uint8> packBits(const Uint8* data, size_t size);
+std::vector<Uint8> unpackBits(const Uint8* data, size_t size, size_t unpackedSize);
+
+// LZ77 in the spirit of LZ4: sequences of literals followed by a match of at least four bytes within the last 64 KiB
+std::vector<Uint8> compressLz(const Uint8* data, size_t size);
+std::vector<Uint8> decompressLz(const Uint8* data, size_t size, size_t decompressedSize);
+
+enum class Codec : Uint8
+{
+    stored,
+    packBits,
+    lz,
+};
+
+struct Chunk
+{
+    Codec codec;
+    std::vector<Uint8> data;
+};
+
+// Whichever codec gives the smallest output, stored when none of them saves anything
+Chunk compressChunk(const Uint8* data, size_t size);
+std::vector<Uint8> decompressChunk(const Chunk& chunk, size_t decompressedSize);
@@ -0,0 +1,102 @@
+#include "ContentHash.hpp"
+#include <cstring>
+
+namespace
+{
+constexpr uint64_t prime1{11400714785074694791ull};
+constexpr uint64_t prime2{14029467366897019727ull};
+constexpr uint64_t prime3{1609587929392839161ull};
+constexpr uint64_t prime4{9650029242287828579ull};
+constexpr uint64_t prime5{2870177450012600261ull};
+
+uint64_t rotateLeft(const uint64_t value, const int bits)
+{
+    return value << bits | value >> (64 - bits);
+}
+
+uint64_t read64(const unsigned char* data)
+{
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t read32(const unsigned char* data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t round(uint64_t accumulator, const uint64_t input)
+{
+    accumulator += input * prime2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * prime1;
+}
+
+uint64_t mergeRound(uint64_t accumulator, const uint64_t value)
+{
+    accumulator ^= round(0, value);
+    return accumulator * prime1 + prime4;
+}
+}
+
+uint64_t hashBytes(const void* data, const size_t size, const uint64_t seed)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = bytes + size;
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        uint64_t lane1 = seed + prime1 + prime2;
+        uint64_t lane2 = seed + prime2;
+        uint64_t lane3 = seed;
+        uint64_t lane4 = seed - prime1;
+
+        for (; end - bytes >= 32; bytes += 32)
+        {
+            lane1 = round(lane1, read64(bytes));
+            lane2 = round(lane2, read64(bytes + 8));
+            lane3 = round(lane3, read64(bytes + 16));
+            lane4 = round(lane4, read64(bytes + 24));
+        }
+
+        hash = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) + rotateLeft(lane3, 12) + rotateLeft(lane4, 18);
+        hash = mergeRound(hash, lane1);
+        hash = mergeRound(hash, lane2);
+        hash = mergeRound(hash, lane3);
+        hash = mergeRound(hash, lane4);
+    }
+    else
+    {
+        hash = seed + prime5;
+    }
+
+    hash += size;
+
+    for (; end - bytes >= 8; bytes += 8)
+    {
+        hash ^= round(0, read64(bytes));
+        hash = rotateLeft(hash, 27) * prime1 + prime4;
+    }
+    if (end - bytes >= 4)
+    {
+        hash ^= read32(bytes) * prime1;
+        hash = rotateLeft(hash, 23) * prime2 + prime3;
+        bytes += 4;
+    }
+    for (; bytes < end; ++bytes)
+    {
+        hash ^= *bytes * prime5;
+        hash = rotateLeft(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 of the bytes. Four independent accumulators take 32 bytes per step, so the multiplies of one step overlap.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
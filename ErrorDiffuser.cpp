@@ -0,0 +1,202 @@
+#include "ErrorDiffuser.hpp"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <thread>
+
+namespace
+{
+constexpr size_t progressGranularity = 32;
+
+int32_t roundedDivide(const int32_t numerator, const int32_t divisor)
+{
+    return (numerator >= 0 ? numerator + divisor / 2 : numerator - divisor / 2) / divisor;
+}
+
+int32_t clampChannel(const int32_t value)
+{
+    return std::clamp<int32_t>(value, 0, 255);
+}
+}
+
+ErrorDiffuser::ErrorDiffuser(const std::vector<std::vector<SDL_Color>>& image, const Palette& palette, const Kernel kernel) : image{image},
+    palette{palette},
+    divisor{1},
+    reach{0},
+    depth{0}
+{
+    switch (kernel)
+    {
+        case Kernel::floydSteinberg:
+            weights = {{1, 0, 7}, {-1, 1, 3}, {0, 1, 5}, {1, 1, 1}};
+            divisor = 16;
+            break;
+
+        case Kernel::atkinson:
+            weights = {{1, 0, 1}, {2, 0, 1}, {-1, 1, 1}, {0, 1, 1}, {1, 1, 1}, {0, 2, 1}};
+            divisor = 8;
+            break;
+
+        case Kernel::jarvisJudiceNinke:
+            weights = {
+                {1, 0, 7}, {2, 0, 5},
+                {-2, 1, 3}, {-1, 1, 5}, {0, 1, 7}, {1, 1, 5}, {2, 1, 3},
+                {-2, 2, 1}, {-1, 2, 3}, {0, 2, 5}, {1, 2, 3}, {2, 2, 1}
+            };
+            divisor = 48;
+            break;
+    }
+
+    for (const auto& [dx, dy, weight] : weights)
+    {
+        reach = std::max(reach, std::abs(dx));
+        depth = std::max(depth, dy);
+    }
+}
+
+std::vector<std::vector<SDL_Color>> ErrorDiffuser::perform(const bool serpentine, unsigned threads, TaskControl* const control) const
+{
+    auto transformedImage = image;
+
+    const size_t lines = image.size();
+    const size_t length = lines == 0 ? 0 : image[0].size();
+    if (length == 0)
+    {
+        return transformedImage;
+    }
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // A serpentine line runs against its predecessor, so it cannot start before the predecessor is complete.
+    const size_t workers = serpentine ? 1 : std::min<size_t>(threads, lines);
+
+    // Each line in flight owns one row of the ring and pushes error into the rows of the next depth lines.
+    // Worker w handles lines w, w + workers, ..., so a row is only recycled after the line that read it is done.
+    // Rows are padded by reach on both sides, errors are kept as numerators over divisor.
+    const size_t ringSize = workers + depth;
+    const size_t stride = (length + 2 * reach) * 3;
+    std::vector<int32_t> errors(ringSize * stride, 0);
+
+    const auto progress = std::make_unique<std::atomic<size_t>[]>(lines);
+    for (size_t line{0}; line < lines; ++line)
+    {
+        progress[line].store(0, std::memory_order_relaxed);
+    }
+
+    // A line may touch pixel x once its predecessor has passed x + 2 * reach: all error for x has arrived then,
+    // and the two lines never write the same row cells at the same time.
+    const size_t lag = 2 * reach + 1;
+
+    expectProgress(control, lines);
+
+    auto diffuseLine = [&](const size_t line)
+    {
+        const bool reversed = serpentine and line % 2 == 1;
+        const auto& source = image[line];
+        auto& target = transformedImage[line];
+        int32_t* const row = errors.data() + (line % ringSize) * stride;
+
+        // Skipped lines still complete in order, so no row of the ring is recycled while a running line uses it
+        if (control and control->isCancelled())
+        {
+            while (line > 0 and progress[line - 1].load(std::memory_order_acquire) < length)
+            {
+                std::this_thread::yield();
+            }
+            progress[line].store(length, std::memory_order_release);
+            return;
+        }
+
+        size_t available = line == 0 ? length : progress[line - 1].load(std::memory_order_acquire);
+
+        for (size_t step{0}; step < length; ++step)
+        {
+            const size_t required = std::min(length, step + lag);
+            while (available < required)
+            {
+                std::this_thread::yield();
+                available = progress[line - 1].load(std::memory_order_acquire);
+            }
+
+            const size_t position = reversed ? length - 1 - step : step;
+            const int32_t* const error = row + (position + reach) * 3;
+
+            const int32_t r = clampChannel(source[position].r + roundedDivide(error[0], divisor));
+            const int32_t g = clampChannel(source[position].g + roundedDivide(error[1], divisor));
+            const int32_t b = clampChannel(source[position].b + roundedDivide(error[2], divisor));
+
+            const auto& chosen = palette[findNeighbour(r, g, b)];
+            target[position] = chosen;
+
+            const int32_t errorR = r - chosen.r;
+            const int32_t errorG = g - chosen.g;
+            const int32_t errorB = b - chosen.b;
+
+            for (const auto& [dx, dy, weight] : weights)
+            {
+                const int offset = reversed ? -dx : dx;
+                int32_t* const destination = errors.data() + ((line + dy) % ringSize) * stride + (position + reach + offset) * 3;
+                destination[0] += errorR * weight;
+                destination[1] += errorG * weight;
+                destination[2] += errorB * weight;
+            }
+
+            if ((step + 1) % progressGranularity == 0 or step + 1 == length)
+            {
+                progress[line].store(step + 1, std::memory_order_release);
+            }
+        }
+
+        std::fill_n(row, stride, 0);
+        reportProgress(control);
+    };
+
+    auto work = [&](const size_t worker)
+    {
+        for (size_t line{worker}; line < lines; line += workers)
+        {
+            diffuseLine(line);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(workers - 1);
+    for (size_t worker{1}; worker < workers; ++worker)
+    {
+        pool.emplace_back(work, worker);
+    }
+    work(0);
+
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+
+    checkCancelled(control);
+    return transformedImage;
+}
+
+size_t ErrorDiffuser::findNeighbour(const int r, const int g, const int b) const
+{
+    int minimum{std::numeric_limits<int>::max()};
+    size_t minimumIndex{};
+
+    for (size_t i{0}; i < palette.size(); ++i)
+    {
+        const int differenceR = r - palette[i].r;
+        const int differenceG = g - palette[i].g;
+        const int differenceB = b - palette[i].b;
+
+        if (const int distance = differenceR * differenceR + differenceG * differenceG + differenceB * differenceB; distance < minimum)
+        {
+            minimum = distance;
+            minimumIndex = i;
+        }
+    }
+
+    return minimumIndex;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "IndexedFormat.hpp"
+#include "TaskControl.hpp"
+
+class ErrorDiffuser
+{
+public:
+    enum class Kernel
+    {
+        floydSteinberg,
+        atkinson,
+        jarvisJudiceNinke,
+    };
+
+    ErrorDiffuser(const std::vector<std::vector<SDL_Color>>& image, const Palette& palette, Kernel kernel);
+
+    // Lines are the contiguous inner vectors of the image. Without serpentine scan the lines are processed
+    // concurrently as a wavefront, each one lagging behind its predecessor by a fixed number of pixels.
+    // Once the control is cancelled the remaining lines are skipped, and TaskCancelled is thrown after every worker is
+    // done.
+    std::vector<std::vector<SDL_Color>> perform(bool serpentine, unsigned threads, TaskControl* control = nullptr) const;
+
+private:
+    struct Weight
+    {
+        int dx;
+        int dy;
+        int32_t weight;
+    };
+
+    const std::vector<std::vector<SDL_Color>>& image;
+    const Palette& palette;
+    std::vector<Weight> weights;
+    int32_t divisor;
+    int reach;
+    int depth;
+
+    size_t findNeighbour(int, int, int) const;
+};
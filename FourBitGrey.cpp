@@ -1,6 +1,19 @@
 #include "FourBitGrey.hpp"
+#include "ColorSpace.hpp"
 
-FourBitGrey::FourBitGrey(const SDL_Color& color) : grey{static_cast<Uint8>((0.299 * color.r + 0.587f * color.g + 0.114f * color.b) * 15.0 / 255.0)}
+namespace
+{
+Uint8 getLevel(const SDL_Color& color, const bool linearLight)
+{
+    if (linearLight)
+    {
+        return static_cast<Uint8>(getLinearLuma(color, getSrgbToLinearTable(), getLinearToSrgbTable()) * 15 / 255);
+    }
+    return static_cast<Uint8>((0.299 * color.r + 0.587f * color.g + 0.114f * color.b) * 15.0 / 255.0);
+}
+}
+
+FourBitGrey::FourBitGrey(const SDL_Color& color, const bool linearLight) : grey{getLevel(color, linearLight)}
 {}
 
 FourBitGrey::FourBitGrey(const Uint8 color) : grey{color}
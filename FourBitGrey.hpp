@@ -4,7 +4,7 @@
 class FourBitGrey
 {
 public:
-    explicit FourBitGrey(const SDL_Color&);
+    explicit FourBitGrey(const SDL_Color&, bool linearLight = false);
     explicit FourBitGrey(Uint8);
 
     SDL_Color getSdlColor() const;
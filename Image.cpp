@@ -1,10 +1,20 @@
 #include "Image.hpp"
 #include <algorithm>
+#include <cctype>
 #include <cmath>
 #include <fstream>
+#include <limits>
 #include <stdexcept>
+#include <utility>
+#include "ColorIndexCache.hpp"
+#include "ContentHash.hpp"
 #include "FourBitColor.hpp"
 #include "FourBitGrey.hpp"
+#include "ImageFile.hpp"
+#include "MedianCutter.hpp"
+#include "OrderedDitherer.hpp"
+#include "PaletteDitherer.hpp"
+#include "ResultCache.hpp"
 #include "UnsupportedDedicatedPalette.hpp"
 
 namespace
@@ -29,40 +39,317 @@ SDL_Color getColorFromSurface(const SDL_Surface* surface, const int x, const int
     return color;
 }
 
+// SDL expands 1 and 4 bit bitmaps to 8 bits per pixel, so every paletted bitmap arrives with a byte per pixel. Fills
+// bmp from the palette and returns the indices too when the bitmap uses at most 16 distinct colors, numbered in the
+// order the dedicated palette transformation would find them.
+std::optional<IndexedImage<defaultBits>> readPalettedSurface(const SDL_Surface* surface, std::vector<std::vector<SDL_Color>>& bmp)
+{
+    using Format = IndexedFormat<defaultBits>;
+    constexpr int unassigned{-1};
+
+    const SDL_Palette* sourcePalette = surface->format->palette;
+    std::array<int, 256> compactIndices;
+    compactIndices.fill(unassigned);
+    size_t colorsCount{0};
+    bool fits{true};
+
+    IndexedImage<defaultBits> indexedImage{Palette{}, bmp.size(), bmp.empty() ? 0 : bmp[0].size(), {}};
+    const size_t lineSize = Format::packedSize(indexedImage.length);
+    indexedImage.indices.resize(indexedImage.lines * lineSize);
+    std::vector<Uint8> indices(indexedImage.length);
+
+    for (size_t x{0}; x < indexedImage.lines; ++x)
+    {
+        for (size_t y{0}; y < indexedImage.length; ++y)
+        {
+            const Uint8 source = static_cast<const Uint8*>(surface->pixels)[surface->pitch * y + x];
+            // As SDL_GetRGB, indices past the palette read as black
+            const SDL_Color color = source < sourcePalette->ncolors ? sourcePalette->colors[source] : SDL_Color{0, 0, 0, 0};
+            bmp[x][y] = SDL_Color{color.r, color.g, color.b, 1};
+
+            if (not fits)
+            {
+                continue;
+            }
+
+            if (compactIndices[source] == unassigned)
+            {
+                const auto end = indexedImage.palette.begin() + colorsCount;
+                const auto found = std::find_if(indexedImage.palette.begin(), end, [&color](const SDL_Color& entry)
+                                                    {
+                                                        return entry.r == color.r and entry.g == color.g and entry.b == color.b;
+                                                    });
+
+                if (found == end and colorsCount == Format::paletteSize)
+                {
+                    fits = false;
+                    continue;
+                }
+                if (found == end)
+                {
+                    indexedImage.palette[colorsCount++] = bmp[x][y];
+                }
+                compactIndices[source] = static_cast<int>(found - indexedImage.palette.begin());
+            }
+            indices[y] = static_cast<Uint8>(compactIndices[source]);
+        }
+
+        if (fits)
+        {
+            Format::pack(indices.data(), indexedImage.length, indexedImage.indices.data() + x * lineSize);
+        }
+    }
+
+    if (not fits)
+    {
+        return std::nullopt;
+    }
+    return indexedImage;
+}
+
+// Case insensitive, extension given in lower case
+bool hasExtension(const std::string& filepath, const std::string& extension)
+{
+    if (filepath.size() < extension.size())
+    {
+        return false;
+    }
+
+    const size_t offset = filepath.size() - extension.size();
+    for (size_t i{0}; i < extension.size(); ++i)
+    {
+        if (std::tolower(static_cast<unsigned char>(filepath[offset + i])) != extension[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Passes of a progressive .gkimg file decoded for a preview
+constexpr size_t previewPasses{2};
+
+std::vector<std::vector<SDL_Color>> toBmp(const IndexedImage<defaultBits>& indexedImage)
+{
+    const size_t lineSize = IndexedFormat<defaultBits>::packedSize(indexedImage.length);
+
+    std::vector<std::vector<SDL_Color>> bmp(indexedImage.lines, std::vector<SDL_Color>(indexedImage.length));
+    std::vector<Uint8> indices(indexedImage.length);
+    for (size_t x{0}; x < indexedImage.lines; ++x)
+    {
+        IndexedFormat<defaultBits>::unpack(indexedImage.indices.data() + x * lineSize, indexedImage.length, indices.data());
+        for (size_t y{0}; y < indexedImage.length; ++y)
+        {
+            bmp[x][y] = indexedImage.palette[indices[y]];
+        }
+    }
+
+    return bmp;
+}
+
+// Bumped whenever a transformation starts giving different results or cache entries change, so older cached results
+// are not reused
+constexpr uint64_t resultVersion{3};
+
+// Transformations that set the palette sampling, the others leave the one of the last median cut
+bool buildsMedianCutPalette(const Image::Transformation transformation)
+{
+    return transformation == Image::Transformation::medianCut or transformation == Image::Transformation::medianCutGreyscale or
+           transformation == Image::Transformation::medianCutDithering;
+}
+
 bool compareSdlColor(const SDL_Color& lhs, const SDL_Color& rhs)
 {
     return lhs.r == rhs.r and lhs.g == rhs.g and lhs.b == rhs.b;
 }
 
-constexpr size_t bayerTableSize = 4;
+// Colors of the dedicated palette in the order they first appear
+Palette findDedicatedPalette(const std::vector<std::vector<SDL_Color>>& bmp, TaskControl* control)
+{
+    std::vector<SDL_Color> dedicatedPalette;
+    dedicatedPalette.reserve(bmp.size() * bmp[0].size());
+
+    expectProgress(control, bmp.size());
+    for (const auto& row : bmp)
+    {
+        checkCancelled(control);
+        for (const auto& pixel : row)
+        {
+            if (std::find_if(dedicatedPalette.begin(), dedicatedPalette.end(), [&pixel](const SDL_Color& color)
+                                 {
+                                     return compareSdlColor(color, pixel);
+                                 }) == dedicatedPalette.end())
+            {
+                dedicatedPalette.emplace_back(pixel);
+            }
+        }
+        reportProgress(control);
+    }
+
+    if (dedicatedPalette.size() > 16)
+    {
+        throw UnsupportedDedicatedPalette{dedicatedPalette.size()};
+    }
+
+    Palette palette{};
+    std::copy(dedicatedPalette.begin(), dedicatedPalette.end(), palette.begin());
+    return palette;
+}
+
+// Regions are widened to start on a multiple of the largest threshold pattern, so ordered dithering of a region
+// matches the same pixels dithered with the whole image
+constexpr size_t regionAlignment{blueNoiseSize};
+// Edits are tracked on the same grid, so a dirty tile needs no widening
+constexpr size_t tileSize{regionAlignment};
 
-constexpr std::array<std::array<int, bayerTableSize>, bayerTableSize> bayerTable{
-    std::array<int, bayerTableSize>{6, 14, 8, 16},
-    std::array<int, bayerTableSize>{10, 2, 12, 4},
-    std::array<int, bayerTableSize>{7, 15, 5, 13},
-    std::array<int, bayerTableSize>{11, 3, 9, 1}
-};
+// Lines of the tile are hashed one after another, each seeded with the hash of the lines before it
+uint64_t hashTile(const std::vector<std::vector<SDL_Color>>& bmp, const size_t firstLine, const size_t first)
+{
+    uint64_t hash{0};
+    const size_t length = std::min(tileSize, bmp[0].size() - first);
+    for (size_t x{firstLine}; x < std::min(firstLine + tileSize, bmp.size()); ++x)
+    {
+        hash = hashBytes(bmp[x].data() + first, length * sizeof(SDL_Color), hash);
+    }
+    return hash;
+}
 
-std::array<std::array<int, bayerTableSize>, bayerTableSize> getUpdatedBayerTable()
+std::vector<std::vector<SDL_Color>> crop(const std::vector<std::vector<SDL_Color>>& bmp, const Image::Region& region)
 {
-    constexpr int range{256};
-    constexpr float factor{range * 1.0f / (bayerTableSize * bayerTableSize)};
-    auto updateBayerTable = bayerTable;
+    std::vector<std::vector<SDL_Color>> part(region.lines);
+    for (size_t x{0}; x < region.lines; ++x)
+    {
+        const auto line = bmp[region.firstLine + x].begin() + region.first;
+        part[x].assign(line, line + region.length);
+    }
+    return part;
+}
 
-    std::for_each(updateBayerTable.begin(), updateBayerTable.end(), [&factor](auto& row)
-                      {
-                          std::for_each(row.begin(), row.end(), [&factor](auto& value)
+// Index of the palette entry nearest to the color, the exact one for palette colors
+size_t findNearest(const Palette& palette, const SDL_Color& color)
+{
+    int minimum{std::numeric_limits<int>::max()};
+    size_t minimumIndex{};
+
+    for (size_t i{0}; i < palette.size(); ++i)
+    {
+        const int differenceR = color.r - palette[i].r;
+        const int differenceG = color.g - palette[i].g;
+        const int differenceB = color.b - palette[i].b;
+
+        if (const int distance = differenceR * differenceR + differenceG * differenceG + differenceB * differenceB; distance < minimum)
+        {
+            minimum = distance;
+            minimumIndex = i;
+        }
+    }
+    return minimumIndex;
+}
+
+// Palette with every color of the pixels outside the regions, followed by the colors of the regions' palette while
+// there is room, so that saving keeps the pixels outside. Nothing when the pixels outside do not fit in a palette or
+// there are none.
+std::optional<Palette> mergePalettes(const std::vector<std::vector<SDL_Color>>& bmp, const std::vector<Image::Region>& regions,
+                                     const Palette& regionsPalette)
+{
+    std::vector<SDL_Color> colors;
+    const auto add = [&colors](const SDL_Color& pixel)
+    {
+        if (std::find_if(colors.begin(), colors.end(), [&pixel](const SDL_Color& color)
+                             {
+                                 return compareSdlColor(color, pixel);
+                             }) == colors.end())
+        {
+            colors.emplace_back(pixel);
+        }
+    };
+
+    for (size_t x{0}; x < bmp.size(); ++x)
+    {
+        for (size_t y{0}; y < bmp[x].size(); ++y)
+        {
+            const bool inside = std::any_of(regions.begin(), regions.end(), [x, y](const Image::Region& region)
                                             {
-                                                value = static_cast<int>((value * factor) - factor / 2);
+                                                return x - region.firstLine < region.lines and y - region.first < region.length;
                                             });
-                      });
+            if (inside or (not colors.empty() and compareSdlColor(colors.back(), bmp[x][y])))
+            {
+                continue;
+            }
 
-    return updateBayerTable;
+            add(bmp[x][y]);
+            if (colors.size() > std::tuple_size_v<Palette>)
+            {
+                return std::nullopt;
+            }
+        }
+    }
+
+    if (colors.empty())
+    {
+        return std::nullopt;
+    }
+
+    for (const auto& color : regionsPalette)
+    {
+        if (colors.size() == std::tuple_size_v<Palette>)
+        {
+            break;
+        }
+        add(color);
+    }
+
+    Palette merged{};
+    std::copy(colors.begin(), colors.end(), merged.begin());
+    return merged;
+}
+
+template <typename Output>
+std::vector<std::vector<SDL_Color>> orderedDithering(const std::vector<std::vector<SDL_Color>>& image, const TransformOptions& options)
+{
+    switch (options.ditheringMatrixSize)
+    {
+        case 2:
+            return OrderedDitherer<BayerPattern<2>, Output>{image, options.threads, options.linearLight, options.control}.perform();
+        case 4:
+            return OrderedDitherer<BayerPattern<4>, Output>{image, options.threads, options.linearLight, options.control}.perform();
+        case 8:
+            return OrderedDitherer<BayerPattern<8>, Output>{image, options.threads, options.linearLight, options.control}.perform();
+        case 16:
+            return OrderedDitherer<BayerPattern<16>, Output>{image, options.threads, options.linearLight, options.control}.perform();
+        default:
+            throw std::runtime_error("Unsupported dithering matrix size: " + std::to_string(options.ditheringMatrixSize));
+    }
 }
 }
 
-Image::Image(const std::string& filepath) : transformedBmp{std::nullopt}, palette{}, currentTransformation{Transformation::none}
+Image::Image(const std::string& filepath, const bool loadPreview) : transformedBmp{std::nullopt}, palette{}, paletteSampling{}, currentTransformation{Transformation::none}, originalIndexed{std::nullopt}, preview{false}, contentHash{0}, tileHashes{}, composited{false}, dirtyTiles{}, dirtyTilesCount{0}, greyHistogram{std::nullopt}, greyHistogramLinearLight{false}
 {
+    if (hasExtension(filepath, ".gkimg"))
+    {
+        std::ifstream file(filepath, std::ios::binary);
+        if (not file)
+        {
+            throw std::runtime_error("Failed to open file: " + filepath);
+        }
+
+        if (loadPreview)
+        {
+            if (const auto previewImage = readImageFilePreview(file, previewPasses))
+            {
+                originalBmp = toBmp(previewImage.value());
+                preview = true;
+                hashContent();
+                return;
+            }
+            file.seekg(0);
+        }
+
+        originalBmp = toBmp(readImageFile(file));
+        hashContent();
+        return;
+    }
+
     SDL_Surface* bmp = SDL_LoadBMP(filepath.c_str());
     if (not bmp)
     {
@@ -71,15 +358,28 @@ Image::Image(const std::string& filepath) : transformedBmp{std::nullopt}, palett
 
     originalBmp.resize(bmp->w, std::vector<SDL_Color>(bmp->h));
 
-    for (int x{0}; x < bmp->w; ++x)
+    if (bmp->format->palette and bmp->format->BytesPerPixel == 1)
     {
-        for (int y{0}; y < bmp->h; ++y)
+        originalIndexed = readPalettedSurface(bmp, originalBmp);
+    }
+    else
+    {
+        for (int x{0}; x < bmp->w; ++x)
         {
-            originalBmp[x][y] = getColorFromSurface(bmp, x, y);
+            for (int y{0}; y < bmp->h; ++y)
+            {
+                originalBmp[x][y] = getColorFromSurface(bmp, x, y);
+            }
         }
     }
 
     SDL_FreeSurface(bmp);
+    hashContent();
+}
+
+Image::Image(std::vector<std::vector<SDL_Color>> bmp) : originalBmp{std::move(bmp)}, transformedBmp{std::nullopt}, palette{}, paletteSampling{}, currentTransformation{Transformation::none}, originalIndexed{std::nullopt}, preview{false}, contentHash{0}, tileHashes{}, composited{false}, dirtyTiles{}, dirtyTilesCount{0}, greyHistogram{std::nullopt}, greyHistogramLinearLight{false}
+{
+    hashContent();
 }
 
 const std::vector<std::vector<SDL_Color>>& Image::getOriginalBmp() const
@@ -92,11 +392,16 @@ const std::optional<std::vector<std::vector<SDL_Color>>>& Image::getTransformedB
     return transformedBmp;
 }
 
-const std::array<SDL_Color, 16>& Image::getPalette() const
+const Palette& Image::getPalette() const
 {
     return palette;
 }
 
+const PaletteSampling& Image::getPaletteSampling() const
+{
+    return paletteSampling;
+}
+
 size_t Image::getRows() const
 {
     return originalBmp.size();
@@ -107,439 +412,634 @@ size_t Image::getColumns() const
     return originalBmp[0].size();
 }
 
-void Image::transform(const Transformation transformation)
+void Image::transform(const Transformation transformation, const TransformOptions& options)
 {
+    composited = false;
+    std::fill(dirtyTiles.begin(), dirtyTiles.end(), false);
+    dirtyTilesCount = 0;
+
+    const bool cached = options.cache and transformation != Transformation::none;
+    const uint64_t key = cached ? getCacheKey(transformation, options) : 0;
+
+    if (cached)
+    {
+        if (const auto entry = options.cache->find(key, getRows(), getColumns()))
+        {
+            restore(transformation, entry->image);
+            if (buildsMedianCutPalette(transformation))
+            {
+                paletteSampling = entry->sampling;
+            }
+            return;
+        }
+    }
+
     switch (transformation)
     {
         case Transformation::none:
             transformedBmp = std::nullopt;
             break;
         case Transformation::imposedPalette:
-            imposedPaletteTransformation();
+            imposedPaletteTransformation(options);
             break;
 
         case Transformation::dedicatedPalette:
-            dedicatedPaletteTransformation();
+            dedicatedPaletteTransformation(options);
             break;
 
         case Transformation::greyscale:
-            greyscaleTransformation();
+            greyscaleTransformation(options);
             break;
 
         case Transformation::dithering:
-            ditheringTransformation();
+            ditheringTransformation(options);
             break;
 
         case Transformation::ditheringGreyscale:
-            ditheringGreyscaleTransformation();
+            ditheringGreyscaleTransformation(options);
+            break;
+
+        case Transformation::ditheringGreyscaleLevels:
+            ditheringGreyscaleLevelsTransformation(options);
+            break;
+
+        case Transformation::blueNoiseDithering:
+            blueNoiseDitheringTransformation(options);
+            break;
+
+        case Transformation::blueNoiseDitheringGreyscale:
+            blueNoiseDitheringGreyscaleTransformation(options);
             break;
 
         case Transformation::medianCut:
-            medianCutTransformation();
+            medianCutTransformation(options);
             break;
 
         case Transformation::medianCutGreyscale:
-            medianCutGreyscaleTransformation();
+            medianCutGreyscaleTransformation(options);
+            break;
+
+        case Transformation::medianCutDithering:
+            medianCutDitheringTransformation(options);
+            break;
+
+        case Transformation::floydSteinberg:
+            errorDiffusionTransformation(transformation, ErrorDiffuser::Kernel::floydSteinberg, options);
+            break;
+
+        case Transformation::atkinson:
+            errorDiffusionTransformation(transformation, ErrorDiffuser::Kernel::atkinson, options);
+            break;
+
+        case Transformation::jarvisJudiceNinke:
+            errorDiffusionTransformation(transformation, ErrorDiffuser::Kernel::jarvisJudiceNinke, options);
             break;
     }
+
+    if (cached)
+    {
+        options.cache->store(key, getIndexed(), paletteSampling);
+    }
 }
 
-void Image::imposedPaletteTransformation()
+void Image::transformRegion(const Transformation transformation, const Region& region, const bool wholeImagePalette, const TransformOptions& options)
 {
-    transformedBmp = originalBmp;
-    for (auto& row : transformedBmp.value())
+    if (region.lines == 0 or region.length == 0 or region.firstLine > getRows() or region.lines > getRows() - region.firstLine or
+        region.first > getColumns() or region.length > getColumns() - region.first)
     {
-        for (auto& pixel : row)
-        {
-            pixel = FourBitColor(pixel).getSdlColor();
-        }
+        throw std::runtime_error("Region is outside the image");
     }
 
-    for (size_t i{0}; i < palette.size(); ++i)
+    if (transformation == Transformation::none)
     {
-        palette[i] = FourBitColor{static_cast<Uint8>(i)}.getSdlColor();
+        if (transformedBmp)
+        {
+            composite(region, Region{0, getRows(), 0, getColumns()}, originalBmp);
+        }
+        return;
     }
 
-    currentTransformation = Transformation::imposedPalette;
+    transformRegions(transformation, {region}, wholeImagePalette, false, options);
 }
 
-void Image::dedicatedPaletteTransformation()
+void Image::setPixels(const size_t firstLine, const size_t first, const std::vector<std::vector<SDL_Color>>& pixels)
 {
-    std::vector<SDL_Color> dedicatedPalette;
-    dedicatedPalette.reserve(originalBmp.size() * originalBmp[0].size());
+    if (pixels.empty() or firstLine > getRows() or pixels.size() > getRows() - firstLine)
+    {
+        throw std::runtime_error("Pixels are outside the image");
+    }
+    for (const auto& line : pixels)
+    {
+        if (first > getColumns() or line.size() > getColumns() - first)
+        {
+            throw std::runtime_error("Pixels are outside the image");
+        }
+    }
 
-    for (const auto& row : originalBmp)
+    const size_t tilesPerLine = (getColumns() + tileSize - 1) / tileSize;
+    if (dirtyTiles.empty())
     {
-        for (const auto& pixel : row)
+        dirtyTiles.assign((getRows() + tileSize - 1) / tileSize * tilesPerLine, false);
+    }
+
+    bool changed{false};
+    size_t length{0};
+    for (size_t x{0}; x < pixels.size(); ++x)
+    {
+        length = std::max(length, pixels[x].size());
+        for (size_t y{0}; y < pixels[x].size(); ++y)
         {
-            if (std::find_if(dedicatedPalette.begin(), dedicatedPalette.end(), [&pixel](const SDL_Color& color)
-                                 {
-                                     return compareSdlColor(color, pixel);
-                                 }) == dedicatedPalette.end())
+            auto& pixel = originalBmp[firstLine + x][first + y];
+            if (compareSdlColor(pixel, pixels[x][y]))
             {
-                dedicatedPalette.emplace_back(pixel);
+                continue;
+            }
+
+            if (greyHistogram)
+            {
+                --greyHistogram.value()[MedianCutter<>::getGrey(pixel, greyHistogramLinearLight)];
+                ++greyHistogram.value()[MedianCutter<>::getGrey(pixels[x][y], greyHistogramLinearLight)];
+            }
+
+            pixel = pixels[x][y];
+            changed = true;
+
+            const size_t tile = (firstLine + x) / tileSize * tilesPerLine + (first + y) / tileSize;
+            if (not dirtyTiles[tile])
+            {
+                dirtyTiles[tile] = true;
+                ++dirtyTilesCount;
             }
         }
     }
 
-    if (dedicatedPalette.size() > 16)
+    if (not changed)
     {
-        throw UnsupportedDedicatedPalette{dedicatedPalette.size()};
+        return;
     }
 
-    currentTransformation = Transformation::dedicatedPalette;
-    clearPalette();
-    std::copy_n(dedicatedPalette.begin(), dedicatedPalette.size(), palette.begin());
-    transformedBmp = originalBmp;
+    // The indices of the bitmap no longer describe it, and only the tiles under the pixels are hashed again
+    originalIndexed = std::nullopt;
+    for (size_t tileLine = firstLine / tileSize; tileLine <= (firstLine + pixels.size() - 1) / tileSize; ++tileLine)
+    {
+        for (size_t tile = first / tileSize; tile <= (first + length - 1) / tileSize; ++tile)
+        {
+            tileHashes[tileLine * tilesPerLine + tile] = hashTile(originalBmp, tileLine * tileSize, tile * tileSize);
+        }
+    }
+    contentHash = hashBytes(tileHashes.data(), tileHashes.size() * sizeof(uint64_t), getRows() << 32 | getColumns());
 }
 
-void Image::greyscaleTransformation()
+void Image::update(const TransformOptions& options)
 {
-    transformedBmp = originalBmp;
-    for (auto& row : transformedBmp.value())
+    if (dirtyTilesCount == 0)
     {
-        for (auto& pixel : row)
+        return;
+    }
+
+    if (transformedBmp)
+    {
+        switch (currentTransformation)
         {
-            pixel = FourBitGrey{pixel}.getSdlColor();
+            // Diffused errors reach every pixel after an edit, so the whole image is diffused again
+            case Transformation::floydSteinberg:
+            case Transformation::atkinson:
+            case Transformation::jarvisJudiceNinke:
+                transform(currentTransformation, options);
+                return;
+
+            case Transformation::none:
+                break;
+
+            default:
+                transformRegions(currentTransformation, getDirtyRegions(), true, true, options);
+                break;
         }
     }
 
-    for (size_t i{0}; i < palette.size(); ++i)
+    std::fill(dirtyTiles.begin(), dirtyTiles.end(), false);
+    dirtyTilesCount = 0;
+}
+
+// Tiles line by line, the same as the dirty ones, and the hash of the image from theirs
+void Image::hashContent()
+{
+    const size_t tilesPerLine = (getColumns() + tileSize - 1) / tileSize;
+    tileHashes.resize((getRows() + tileSize - 1) / tileSize * tilesPerLine);
+    for (size_t tile{0}; tile < tileHashes.size(); ++tile)
     {
-        palette[i] = FourBitGrey{static_cast<Uint8>(i)}.getSdlColor();
+        tileHashes[tile] = hashTile(originalBmp, tile / tilesPerLine * tileSize, tile % tilesPerLine * tileSize);
     }
-
-    currentTransformation = Transformation::greyscale;
+    contentHash = hashBytes(tileHashes.data(), tileHashes.size() * sizeof(uint64_t), getRows() << 32 | getColumns());
 }
 
-void Image::ditheringTransformation()
+// A histogram of every pixel is kept after a greyscale median cut, so that edits update it instead of counting again
+void Image::keepGreyHistogram(const MedianCutter<>& medianCutter, const TransformOptions& options)
 {
-    transformedBmp = originalBmp;
-    const auto updatedBayerTable = getUpdatedBayerTable();
-    for (size_t x{0}; x < transformedBmp.value().size(); ++x)
+    if (medianCutter.getSampling().sampledPixels == medianCutter.getSampling().totalPixels)
     {
-        for (size_t y{0}; y < transformedBmp.value()[x].size(); ++y)
-        {
-            auto& pixel = transformedBmp.value()[x][y];
-            pixel = FourBitColor(pixel).getSdlColor();
+        greyHistogram = medianCutter.getGreyHistogram();
+        greyHistogramLinearLight = options.linearLight;
+    }
+}
 
-            const auto& updatedBayerTableValue = updatedBayerTable[y % bayerTableSize][x % bayerTableSize];
+size_t Image::getDirtyTilesCount() const
+{
+    return dirtyTilesCount;
+}
 
-            if (pixel.r > updatedBayerTableValue)
+void Image::transformRegions(const Transformation transformation, std::vector<Region> regions, const bool wholeImagePalette, const bool remapWhenPaletteMoves, const TransformOptions& options)
+{
+    TransformOptions partOptions = options;
+    partOptions.cache = nullptr;
+
+    const bool greyscale = transformation == Transformation::medianCutGreyscale;
+    const bool wholeMedianCut = wholeImagePalette and (transformation == Transformation::medianCut or transformation == Transformation::medianCutGreyscale or
+                                                       transformation == Transformation::medianCutDithering);
+    const bool wholeDedicated = wholeImagePalette and transformation == Transformation::dedicatedPalette;
+
+    // The palette is built once from the whole image and every region is mapped onto it
+    Palette regionsPalette{};
+    std::optional<MedianCutter<>> medianCutter;
+    std::optional<PaletteDitherer> paletteDitherer;
+    if (wholeMedianCut)
+    {
+        medianCutter.emplace(originalBmp, regionsPalette, partOptions);
+        const size_t total = getRows() * getColumns();
+        if (greyscale and greyHistogram and greyHistogramLinearLight == options.linearLight and
+            (options.paletteSampleSize == 0 or options.paletteSampleSize >= total))
+        {
+            medianCutter->buildGreyscalePalette(greyHistogram.value());
+        }
+        else
+        {
+            medianCutter->buildPalette(greyscale);
+            if (greyscale)
             {
-                pixel.r = 255;
+                keepGreyHistogram(medianCutter.value(), options);
             }
-            else
-            {}
+        }
+        paletteSampling = medianCutter->getSampling();
 
-            if (pixel.g > updatedBayerTableValue)
-            {
-                pixel.g = 255;
-            }
-            else
-            {
-                pixel.g = 0;
-            }
+        if (transformation == Transformation::medianCutDithering)
+        {
+            paletteDitherer.emplace(regionsPalette, options.ditheringMatrixSize, options.threads, options.colorMetric);
+        }
 
-            if (pixel.b > updatedBayerTableValue)
-            {
-                pixel.b = 255;
-            }
-            else
-            {
-                pixel.b = 0;
-            }
+        // Pixels outside the regions were mapped onto the old palette
+        if (remapWhenPaletteMoves and not std::equal(regionsPalette.begin(), regionsPalette.end(), palette.begin(), compareSdlColor))
+        {
+            regions = {Region{0, getRows(), 0, getColumns()}};
         }
     }
+    else if (wholeDedicated)
+    {
+        regionsPalette = originalIndexed ? originalIndexed->palette : findDedicatedPalette(originalBmp, options.control);
+    }
 
-    for (size_t i{0}; i < palette.size(); ++i)
+    const bool hadResult = transformedBmp.has_value();
+    if (not transformedBmp)
     {
-        palette[i] = FourBitColor{static_cast<Uint8>(i)}.getSdlColor();
+        transformedBmp = originalBmp;
     }
 
-    currentTransformation = Transformation::dithering;
-}
+    for (const auto& region : regions)
+    {
+        const size_t firstLine = region.firstLine / regionAlignment * regionAlignment;
+        const size_t first = region.first / regionAlignment * regionAlignment;
+        const Region aligned{firstLine, region.firstLine + region.lines - firstLine, first, region.first + region.length - first};
 
-void Image::ditheringGreyscaleTransformation()
-{
-    transformedBmp = originalBmp;
-    const auto updatedBayerTable = getUpdatedBayerTable();
-    for (size_t x{0}; x < transformedBmp.value().size(); ++x)
+        if (paletteDitherer)
+        {
+            composite(region, aligned, paletteDitherer->perform(crop(originalBmp, aligned), options.control));
+        }
+        else if (medianCutter)
+        {
+            composite(region, aligned, medianCutter->map(crop(originalBmp, aligned), greyscale));
+        }
+        else if (wholeDedicated)
+        {
+            composite(region, Region{0, getRows(), 0, getColumns()}, originalBmp);
+        }
+        else
+        {
+            Image part{crop(originalBmp, aligned)};
+            part.transform(transformation, partOptions);
+            composite(region, aligned, part.transformedBmp.value());
+
+            regionsPalette = part.palette;
+            paletteSampling = part.paletteSampling;
+        }
+    }
+
+    // Pixels outside the regions keep their colors when the palette changes, colors of the regions that did not fit
+    // into the merged palette are taken to the nearest ones left
+    const std::optional<Palette> merged =
+        hadResult and not std::equal(regionsPalette.begin(), regionsPalette.end(), palette.begin(), compareSdlColor)
+            ? mergePalettes(transformedBmp.value(), regions, regionsPalette)
+            : std::nullopt;
+    if (merged)
     {
-        for (size_t y{0}; y < transformedBmp.value()[x].size(); ++y)
+        ColorIndexCache cache;
+        const auto search = [&merged](const SDL_Color& color)
         {
-            auto& [r, g, b, a] = transformedBmp.value()[x][y];
+            return findNearest(merged.value(), color);
+        };
 
-            if (r > updatedBayerTable[y % bayerTableSize][x % bayerTableSize])
-            {
-                r = 255;
-                g = 255;
-                b = 255;
-            }
-            else
+        for (const auto& region : regions)
+        {
+            for (size_t x{region.firstLine}; x < region.firstLine + region.lines; ++x)
             {
-                r = 0;
-                g = 0;
-                b = 0;
+                const auto line = transformedBmp.value()[x].begin() + region.first;
+                std::transform(line, line + region.length, line, [&](const SDL_Color& pixel)
+                               {
+                                   return merged.value()[cache.find(pixel, search)];
+                               });
             }
         }
     }
 
-    for (size_t i{0}; i < palette.size(); ++i)
+    palette = merged.value_or(regionsPalette);
+    currentTransformation = transformation;
+    composited = true;
+}
+
+// Pixels of the region taken from the part, which covers the source region of the image
+void Image::composite(const Region& region, const Region& source, const std::vector<std::vector<SDL_Color>>& part)
+{
+    for (size_t x{0}; x < region.lines; ++x)
     {
-        palette[i] = FourBitGrey{static_cast<Uint8>(i)}.getSdlColor();
+        const auto line = part[region.firstLine - source.firstLine + x].begin() + (region.first - source.first);
+        std::copy_n(line, region.length, transformedBmp.value()[region.firstLine + x].begin() + region.first);
     }
-
-    currentTransformation = Transformation::ditheringGreyscale;
 }
 
-void Image::medianCutTransformation()
+// Runs of dirty tiles along the lines of each band of tiles
+std::vector<Image::Region> Image::getDirtyRegions() const
 {
-    MedianCutter medianCutter{originalBmp, palette};
-    transformedBmp = medianCutter.perform(false);
+    std::vector<Region> regions;
+    const size_t tilesPerLine = (getColumns() + tileSize - 1) / tileSize;
+
+    for (size_t tile{0}; tile < dirtyTiles.size(); ++tile)
+    {
+        if (not dirtyTiles[tile])
+        {
+            continue;
+        }
+
+        const size_t firstLine = tile / tilesPerLine * tileSize;
+        const size_t first = tile % tilesPerLine * tileSize;
+        if (not regions.empty() and regions.back().firstLine == firstLine and regions.back().first + regions.back().length == first)
+        {
+            regions.back().length = std::min(first + tileSize, getColumns()) - regions.back().first;
+            continue;
+        }
+        regions.push_back(Region{firstLine, std::min(tileSize, getRows() - firstLine), first, std::min(tileSize, getColumns() - first)});
+    }
+
+    return regions;
 }
 
-void Image::medianCutGreyscaleTransformation()
+uint64_t Image::getCacheKey(const Transformation transformation, const TransformOptions& options) const
 {
-    MedianCutter medianCutter{originalBmp, palette};
-    transformedBmp = medianCutter.perform(true);
+    const uint64_t fields[]{
+        resultVersion,
+        static_cast<uint64_t>(transformation),
+        options.ditheringMatrixSize,
+        options.serpentine,
+        options.paletteSampleSize,
+        options.paletteSampleSeed,
+        static_cast<uint64_t>(options.colorMetric),
+        options.linearLight,
+        originalIndexed.has_value(),
+    };
+    return hashBytes(fields, sizeof(fields), contentHash);
 }
 
-void Image::clearPalette()
+void Image::restore(const Transformation transformation, const IndexedImage<defaultBits>& result)
 {
-    std::fill(palette.begin(), palette.end(), SDL_Color{0, 0, 0, 0});
+    if (result.lines != getRows() or result.length != getColumns())
+    {
+        throw std::runtime_error("Result does not match the image size");
+    }
+
+    transformedBmp = toBmp(result);
+    palette = result.palette;
+    currentTransformation = transformation;
 }
 
-Image::MedianCutter::MedianCutter(const std::vector<std::vector<SDL_Color>>& image, std::array<SDL_Color, 16>& palette) : image{image},
-    palette{palette},
-    bucketsCount{0},
-    colorsCount{0}
+void Image::imposedPaletteTransformation(const TransformOptions& options)
 {
-    colors.reserve(image.size() * image[0].size());
-    greys.reserve(image.size() * image[0].size());
-
-    for (const auto& row : image)
+    transformedBmp = originalBmp;
+    expectProgress(options.control, originalBmp.size());
+    for (auto& row : transformedBmp.value())
     {
-        for (const auto& pixel : row)
+        checkCancelled(options.control);
+        for (auto& pixel : row)
         {
-            colors.emplace_back(pixel);
-            greys.emplace_back(static_cast<Uint8>(0.299 * pixel.r + 0.587 * pixel.g + 0.114 * pixel.b));
+            pixel = FourBitColor(pixel).getSdlColor();
         }
+        reportProgress(options.control);
     }
-}
 
-std::vector<std::vector<SDL_Color>> Image::MedianCutter::perform(const bool greyscale)
-{
-    if (greyscale)
+    for (size_t i{0}; i < palette.size(); ++i)
     {
-        return performGreyscale();
+        palette[i] = FourBitColor{static_cast<Uint8>(i)}.getSdlColor();
     }
-    return performColor();
+
+    currentTransformation = Transformation::imposedPalette;
 }
 
-std::vector<std::vector<SDL_Color>> Image::MedianCutter::performColor()
+void Image::dedicatedPaletteTransformation(const TransformOptions& options)
 {
-    constexpr int iteration{4};
-
-    medianCut(0, colors.size() - 1, iteration);
+    palette = originalIndexed ? originalIndexed->palette : findDedicatedPalette(originalBmp, options.control);
+    transformedBmp = originalBmp;
 
-    auto transformedImage = image;
+    currentTransformation = Transformation::dedicatedPalette;
+}
 
-    for (auto& row : transformedImage)
+void Image::greyscaleTransformation(const TransformOptions& options)
+{
+    transformedBmp = originalBmp;
+    expectProgress(options.control, originalBmp.size());
+    for (auto& row : transformedBmp.value())
     {
+        checkCancelled(options.control);
         for (auto& pixel : row)
         {
-            pixel = palette[findNeighbour(pixel)];
+            pixel = FourBitGrey{pixel, options.linearLight}.getSdlColor();
         }
+        reportProgress(options.control);
+    }
+
+    for (size_t i{0}; i < palette.size(); ++i)
+    {
+        palette[i] = FourBitGrey{static_cast<Uint8>(i)}.getSdlColor();
     }
 
-    return transformedImage;
+    currentTransformation = Transformation::greyscale;
 }
 
-void Image::MedianCutter::medianCut(const size_t start, const size_t end, const int iteration)
+void Image::ditheringTransformation(const TransformOptions& options)
 {
-    if (iteration > 0)
-    {
-        const SortBy sortBy = greatestDifference(start, end);
-        sortBucket(start, end, sortBy);
+    transformedBmp = orderedDithering<ColorOutput>(originalBmp, options);
 
-        const size_t medium = (start + end + 1) / 2;
-
-        medianCut(start, medium - 1, iteration - 1);
-        medianCut(medium, end, iteration - 1);
-        return;
+    for (size_t i{0}; i < palette.size(); ++i)
+    {
+        palette[i] = FourBitColor{static_cast<Uint8>(i)}.getSdlColor();
     }
 
-    int sumR{0}, sumG{0}, sumB{0};
+    currentTransformation = Transformation::dithering;
+}
+
+void Image::ditheringGreyscaleTransformation(const TransformOptions& options)
+{
+    transformedBmp = orderedDithering<GreyscaleOutput<2>>(originalBmp, options);
 
-    for (size_t p{start}; p <= end; ++p)
+    for (size_t i{0}; i < palette.size(); ++i)
     {
-        sumR += colors[p].r;
-        sumG += colors[p].g;
-        sumB += colors[p].b;
+        palette[i] = FourBitGrey{static_cast<Uint8>(i)}.getSdlColor();
     }
 
-    const int averageR = sumR / static_cast<int>((end - start + 1));
-    const int averageG = sumG / static_cast<int>((end - start + 1));
-    const int averageB = sumB / static_cast<int>((end - start + 1));
-
-    palette[bucketsCount++] = SDL_Color{static_cast<Uint8>(averageR), static_cast<Uint8>(averageG), static_cast<Uint8>(averageB), 1};
+    currentTransformation = Transformation::ditheringGreyscale;
 }
 
-Image::MedianCutter::SortBy Image::MedianCutter::greatestDifference(const size_t start, const size_t end) const
+void Image::ditheringGreyscaleLevelsTransformation(const TransformOptions& options)
 {
-    size_t minR{start}, minG{start}, minB{start};
-    size_t maxR{start}, maxG{start}, maxB{start};
+    transformedBmp = orderedDithering<GreyscaleOutput<16>>(originalBmp, options);
 
-    for (auto i{start}; i <= end; ++i)
+    for (size_t i{0}; i < palette.size(); ++i)
     {
-        if (colors[i].r < colors[minR].r)
-        {
-            minR = i;
-        }
-        if (colors[i].r > colors[maxR].r)
-        {
-            maxR = i;
-        }
-
-        if (colors[i].g < colors[minG].g)
-        {
-            minG = i;
-        }
-        if (colors[i].g > colors[maxG].g)
-        {
-            maxG = i;
-        }
-
-        if (colors[i].b < colors[minB].b)
-        {
-            minB = i;
-        }
-        if (colors[i].b > colors[maxB].b)
-        {
-            maxB = i;
-        }
+        palette[i] = FourBitGrey{static_cast<Uint8>(i)}.getSdlColor();
     }
 
-    const auto differenceR = colors[maxR].r - colors[minR].r;
-    const auto differenceG = colors[maxG].g - colors[minG].g;
-    const auto differenceB = colors[maxB].b - colors[minB].b;
+    currentTransformation = Transformation::ditheringGreyscaleLevels;
+}
 
-    const auto differenceMax = std::max(std::max(differenceR, differenceG), differenceB);
+void Image::blueNoiseDitheringTransformation(const TransformOptions& options)
+{
+    transformedBmp = OrderedDitherer<BlueNoisePattern, ColorOutput>{originalBmp, options.threads, options.linearLight, options.control}.perform();
 
-    if (differenceMax == differenceR)
-    {
-        return SortBy::red;
-    }
-    if (differenceMax == differenceG)
+    for (size_t i{0}; i < palette.size(); ++i)
     {
-        return SortBy::green;
+        palette[i] = FourBitColor{static_cast<Uint8>(i)}.getSdlColor();
     }
-    return SortBy::blue;
-}
 
-void Image::MedianCutter::sortBucket(const size_t start, const size_t end, const SortBy sortBy)
-{
-    std::sort(colors.begin() + start, colors.begin() + end, [sortBy](const SDL_Color& lhs, const SDL_Color& rhs)
-                  {
-                      switch (sortBy)
-                      {
-                          case SortBy::red:
-                              return lhs.r < rhs.r;
-                          case SortBy::green:
-                              return lhs.g < rhs.g;
-                          case SortBy::blue:
-                              return lhs.b < rhs.b;
-                          default:
-                              throw std::runtime_error("Invalid SortBy value");
-                      }
-                  });
+    currentTransformation = Transformation::blueNoiseDithering;
 }
 
-size_t Image::MedianCutter::findNeighbour(const SDL_Color color) const
+void Image::blueNoiseDitheringGreyscaleTransformation(const TransformOptions& options)
 {
-    double minimum{std::numeric_limits<double>::max()};
-    size_t minimumIndex{};
+    transformedBmp = OrderedDitherer<BlueNoisePattern, GreyscaleOutput<16>>{originalBmp, options.threads, options.linearLight, options.control}.perform();
 
     for (size_t i{0}; i < palette.size(); ++i)
     {
-        const auto& [paletteColorR, paletteColorG, paletteColorB, _] = palette[i];
-
-        if (const double distance = sqrt((color.r - paletteColorR) * (color.r - paletteColorR) +
-                                         (color.g - paletteColorG) * (color.g - paletteColorG) +
-                                         (color.b - paletteColorB) * (color.b - paletteColorB)); distance < minimum)
-        {
-            minimum = distance;
-            minimumIndex = i;
-        }
+        palette[i] = FourBitGrey{static_cast<Uint8>(i)}.getSdlColor();
     }
 
-    return minimumIndex;
+    currentTransformation = Transformation::blueNoiseDitheringGreyscale;
 }
 
-std::vector<std::vector<SDL_Color>> Image::MedianCutter::performGreyscale()
+void Image::medianCutTransformation(const TransformOptions& options)
 {
-    constexpr int iteration{4};
-
-    medianCutGreyscale(0, greys.size() - 1, iteration);
+    MedianCutter<> medianCutter{originalBmp, palette, options};
+    transformedBmp = medianCutter.perform(false);
+    paletteSampling = medianCutter.getSampling();
 
-    auto transformedImage = image;
+    currentTransformation = Transformation::medianCut;
+}
 
-    for (auto& row : transformedImage)
-    {
-        for (auto& pixel : row)
-        {
-            pixel = palette[findNeighbourGreyscale(pixel)];
-        }
-    }
+void Image::medianCutGreyscaleTransformation(const TransformOptions& options)
+{
+    MedianCutter<> medianCutter{originalBmp, palette, options};
+    transformedBmp = medianCutter.perform(true);
+    paletteSampling = medianCutter.getSampling();
+    keepGreyHistogram(medianCutter, options);
 
-    return transformedImage;
+    currentTransformation = Transformation::medianCutGreyscale;
 }
 
-void Image::MedianCutter::medianCutGreyscale(const size_t start, const size_t end, const int iteration)
+void Image::medianCutDitheringTransformation(const TransformOptions& options)
 {
-    if (iteration > 0)
-    {
-        sortBucketGreyscale(start, end);
+    MedianCutter<> medianCutter{originalBmp, palette, options};
+    medianCutter.buildPalette(false);
+    paletteSampling = medianCutter.getSampling();
 
-        const size_t medium = (start + end + 1) / 2;
+    const PaletteDitherer paletteDitherer{palette, options.ditheringMatrixSize, options.threads, options.colorMetric};
+    transformedBmp = paletteDitherer.perform(originalBmp, options.control);
 
-        medianCutGreyscale(start, medium - 1, iteration - 1);
-        medianCutGreyscale(medium, end, iteration - 1);
-        return;
-    }
+    currentTransformation = Transformation::medianCutDithering;
+}
 
-    int sumGrey{0};
-    for (size_t p{start}; p <= end; ++p)
+void Image::errorDiffusionTransformation(const Transformation transformation, const ErrorDiffuser::Kernel kernel, const TransformOptions& options)
+{
+    for (size_t i{0}; i < palette.size(); ++i)
     {
-        sumGrey += greys[p];
+        palette[i] = FourBitColor{static_cast<Uint8>(i)}.getSdlColor();
     }
 
-    const Uint8 newGrey = sumGrey / static_cast<Uint8>((end - start + 1));
-    palette[bucketsCount++] = SDL_Color{newGrey, newGrey, newGrey, 1};
+    const ErrorDiffuser errorDiffuser{originalBmp, palette, kernel};
+    transformedBmp = errorDiffuser.perform(options.serpentine, options.threads, options.control);
+
+    currentTransformation = transformation;
 }
 
-void Image::MedianCutter::sortBucketGreyscale(const size_t start, const size_t end)
+template <unsigned Bits>
+IndexedImage<Bits> Image::medianCutIndexed(const bool greyscale, const TransformOptions& options) const
 {
-    std::sort(greys.begin() + start, greys.begin() + end);
+    IndexedImage<Bits> indexedImage{};
+    indexedImage.lines = getRows();
+    indexedImage.length = getColumns();
+
+    MedianCutter<Bits> medianCutter{originalBmp, indexedImage.palette, options};
+    indexedImage.indices = medianCutter.performIndexed(greyscale);
+
+    return indexedImage;
 }
 
-size_t Image::MedianCutter::findNeighbourGreyscale(const SDL_Color color) const
+template IndexedImage<1> Image::medianCutIndexed<1>(bool, const TransformOptions&) const;
+template IndexedImage<4> Image::medianCutIndexed<4>(bool, const TransformOptions&) const;
+template IndexedImage<8> Image::medianCutIndexed<8>(bool, const TransformOptions&) const;
+
+IndexedImage<defaultBits> Image::getIndexed() const
 {
-    const Uint8 grey = static_cast<Uint8>(0.299 * color.r + 0.587 * color.g + 0.114 * color.b);
-    int min{std::numeric_limits<int>::max()};
-    size_t minIndex{};
+    if (not transformedBmp)
+    {
+        throw std::runtime_error("Image is not transformed");
+    }
 
-    for (size_t i{0}; i < palette.size(); ++i)
+    if (originalIndexed and currentTransformation == Transformation::dedicatedPalette and not composited)
     {
-        if (const int distance = abs(grey - palette[i].r); distance < min)
+        return originalIndexed.value();
+    }
+
+    IndexedImage<defaultBits> indexedImage{palette, getRows(), getColumns(), {}};
+    const size_t lineSize = IndexedFormat<defaultBits>::packedSize(indexedImage.length);
+    indexedImage.indices.resize(indexedImage.lines * lineSize);
+
+    // Transformed pixels are palette colors, the nearest entry is the exact one
+    ColorIndexCache cache;
+    const auto search = [this](const SDL_Color& color)
+    {
+        return findNearest(palette, color);
+    };
+
+    std::vector<Uint8> indices(indexedImage.length);
+    for (size_t x{0}; x < indexedImage.lines; ++x)
+    {
+        for (size_t y{0}; y < indexedImage.length; ++y)
         {
-            min = distance;
-            minIndex = i;
+            indices[y] = static_cast<Uint8>(cache.find(transformedBmp.value()[x][y], search));
         }
+        IndexedFormat<defaultBits>::pack(indices.data(), indexedImage.length, indexedImage.indices.data() + x * lineSize);
     }
 
-    return minIndex;
+    return indexedImage;
+}
+
+uint64_t Image::getContentHash() const
+{
+    return contentHash;
 }
 
 bool Image::isTransformed() const
@@ -547,9 +1047,19 @@ bool Image::isTransformed() const
     return transformedBmp.has_value();
 }
 
+Image::Transformation Image::getTransformation() const
+{
+    return transformedBmp ? currentTransformation : Transformation::none;
+}
+
+bool Image::isPreview() const
+{
+    return preview;
+}
+
 std::ofstream& operator<<(std::ofstream& file, const Image& image)
 {
-    // TODO
+    writeImageFile(file, image.getIndexed());
 
     return file;
 }
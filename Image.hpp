@@ -1,10 +1,15 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <vector>
 #include <SDL2/SDL.h>
+#include "ErrorDiffuser.hpp"
+#include "IndexedFormat.hpp"
+#include "MedianCutter.hpp"
+#include "TransformOptions.hpp"
 
 class Image
 {
@@ -19,69 +24,115 @@ public:
         ditheringGreyscale,
         medianCut,
         medianCutGreyscale,
+        floydSteinberg,
+        atkinson,
+        jarvisJudiceNinke,
+        ditheringGreyscaleLevels,
+        medianCutDithering,
+        blueNoiseDithering,
+        blueNoiseDitheringGreyscale,
     };
 
-    explicit Image(const std::string&);
+    // Lines [firstLine, firstLine + lines) cut to positions [first, first + length) of each line
+    struct Region
+    {
+        size_t firstLine;
+        size_t lines;
+        size_t first;
+        size_t length;
+    };
 
-    void transform(Transformation);
+    // Loads a bitmap, or a .gkimg file written by operator<<. With preview set, a progressive .gkimg file loads only its
+    // first passes, scaled up to the full size.
+    explicit Image(const std::string&, bool preview = false);
+
+    void transform(Transformation, const TransformOptions& = TransformOptions{});
+    // Transforms only the pixels of the region and puts them into the transformed image, the rest of which keeps what
+    // it had, or the original pixels when there was nothing. Median cut and dedicated palettes are built from the whole
+    // image with wholeImagePalette set, otherwise from the region alone. When the region's palette differs from the
+    // one of the transformed image, the image gets every color left outside the region and as many of the region's
+    // as still fit, the rest of the region taking the nearest ones, so saving does not change pixels outside. With no
+    // transformed image, or too many colors outside it, the palette becomes the region's. Transformation::none puts
+    // the original pixels back. Results are not cached.
+    void transformRegion(Transformation, const Region&, bool wholeImagePalette, const TransformOptions& = TransformOptions{});
+
+    // Copies the pixels into the original image, their first line and position at the given ones. Tiles of 64 by 64
+    // pixels where a pixel changed are dirty until the next transformation or update.
+    void setPixels(size_t firstLine, size_t first, const std::vector<std::vector<SDL_Color>>&);
+    // Transforms the dirty tiles again with the last transformation, and pixels outside them only when the median cut
+    // palette moved. The greyscale median cut is cut again from a histogram of greys which edits keep up to date, the
+    // color ones sort every pixel, or the sampled ones, again. Error diffusion transforms the whole image again.
+    void update(const TransformOptions& = TransformOptions{});
+    size_t getDirtyTilesCount() const;
+    // Makes the result the transformed image, as if the transformation had just produced it. The palette sampling is
+    // left as it is.
+    void restore(Transformation, const IndexedImage<defaultBits>&);
 
     size_t getRows() const;
     size_t getColumns() const;
 
     bool isTransformed() const;
+    Transformation getTransformation() const;
+    // Loaded as a coarse preview of a progressive .gkimg file
+    bool isPreview() const;
 
     const std::vector<std::vector<SDL_Color>>& getOriginalBmp() const;
     const std::optional<std::vector<std::vector<SDL_Color>>>& getTransformedBmp() const;
-    const std::array<SDL_Color, 16>& getPalette() const;
+    const Palette& getPalette() const;
+    // Accuracy of the last median cut palette when it was built from a sample
+    const PaletteSampling& getPaletteSampling() const;
+
+    // Median cut of the original image to 2^Bits colors, for targets of 1 or 8 bits per pixel such as the bitmaps of
+    // writeBmpFile
+    template <unsigned Bits>
+    IndexedImage<Bits> medianCutIndexed(bool greyscale, const TransformOptions& = TransformOptions{}) const;
+    // Transformed image as indices into the palette
+    IndexedImage<defaultBits> getIndexed() const;
+    // Hash of the original pixels, from hashes of its tiles so that edits hash again only the tiles they touch
+    uint64_t getContentHash() const;
+    // Identifies the result of a transformation with the given options, threads and control aside
+    uint64_t getCacheKey(Transformation, const TransformOptions&) const;
 
     friend std::ofstream& operator<<(std::ofstream&, const Image&);
 
 private:
     std::vector<std::vector<SDL_Color>> originalBmp;
     std::optional<std::vector<std::vector<SDL_Color>>> transformedBmp;
-    std::array<SDL_Color, 16> palette;
+    Palette palette;
+    PaletteSampling paletteSampling;
     Transformation currentTransformation;
-
-    class MedianCutter
-    {
-    public:
-        MedianCutter(const std::vector<std::vector<SDL_Color>>& image, std::array<SDL_Color, 16>& palette);
-
-        std::vector<std::vector<SDL_Color>> perform(bool);
-
-    private:
-        enum class SortBy
-        {
-            red,
-            green,
-            blue,
-        };
-
-        const std::vector<std::vector<SDL_Color>>& image;
-        std::array<SDL_Color, 16>& palette;
-        int bucketsCount;
-        int colorsCount;
-        std::vector<SDL_Color> colors;
-        std::vector<Uint8> greys;
-
-        std::vector<std::vector<SDL_Color>> performGreyscale();
-        void medianCutGreyscale(size_t, size_t, int);
-        void sortBucketGreyscale(size_t, size_t);
-        size_t findNeighbourGreyscale(SDL_Color) const;
-
-        std::vector<std::vector<SDL_Color>> performColor();
-        size_t findNeighbour(SDL_Color) const;
-        void medianCut(size_t, size_t, int);
-        SortBy greatestDifference(size_t, size_t) const;
-        void sortBucket(size_t, size_t, SortBy);
-    };
-
-    void imposedPaletteTransformation();
-    void dedicatedPaletteTransformation() noexcept(false);
-    void greyscaleTransformation();
-    void ditheringTransformation();
-    void ditheringGreyscaleTransformation();
-    void medianCutTransformation();
-    void medianCutGreyscaleTransformation();
-    void clearPalette();
+    // Indices of a paletted bitmap with at most 16 colors, which the dedicated palette passes through as they are
+    std::optional<IndexedImage<defaultBits>> originalIndexed;
+    bool preview;
+    uint64_t contentHash;
+    std::vector<uint64_t> tileHashes;
+    // Parts of the transformed image were put there by transformRegion
+    bool composited;
+    // Tiles line by line, empty until the first edit
+    std::vector<bool> dirtyTiles;
+    size_t dirtyTilesCount;
+    // Greys of every pixel since the last greyscale median cut, which did not sample them
+    std::optional<MedianCutter<>::GreyHistogram> greyHistogram;
+    bool greyHistogramLinearLight;
+
+    explicit Image(std::vector<std::vector<SDL_Color>>);
+
+    void imposedPaletteTransformation(const TransformOptions&);
+    void dedicatedPaletteTransformation(const TransformOptions&) noexcept(false);
+    void greyscaleTransformation(const TransformOptions&);
+    void ditheringTransformation(const TransformOptions&);
+    void ditheringGreyscaleTransformation(const TransformOptions&);
+    void ditheringGreyscaleLevelsTransformation(const TransformOptions&);
+    void blueNoiseDitheringTransformation(const TransformOptions&);
+    void blueNoiseDitheringGreyscaleTransformation(const TransformOptions&);
+    void medianCutTransformation(const TransformOptions&);
+    void medianCutGreyscaleTransformation(const TransformOptions&);
+    void medianCutDitheringTransformation(const TransformOptions&);
+    void errorDiffusionTransformation(Transformation, ErrorDiffuser::Kernel, const TransformOptions&);
+    // With remapWhenPaletteMoves the whole image is mapped when the median cut palette differs from the current one
+    void transformRegions(Transformation, std::vector<Region>, bool wholeImagePalette, bool remapWhenPaletteMoves, const TransformOptions&);
+    void composite(const Region&, const Region& source, const std::vector<std::vector<SDL_Color>>& part);
+    std::vector<Region> getDirtyRegions() const;
+    void hashContent();
+    void keepGreyHistogram(const MedianCutter<>&, const TransformOptions&);
 };
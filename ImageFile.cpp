@@ -0,0 +1,467 @@
+#include "ImageFile.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include "Compression.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+using Format = IndexedFormat<defaultBits>;
+
+constexpr char magic[4]{'G', 'K', 'I', 'M'};
+// Version 1 kept each strip header in front of its data, version 2 collects them in a table after the palette and
+// version 3 adds the layout of the pixels
+constexpr Uint8 version{3};
+constexpr size_t linesPerStrip{16};
+
+enum class Layout : Uint8
+{
+    sequential,
+    progressive,
+};
+
+struct StripEntry
+{
+    Codec codec;
+    Uint32 size;
+    // From the start of the file
+    uint64_t offset;
+};
+
+struct Header
+{
+    IndexedImage<defaultBits> image;
+    size_t stripLines;
+    Layout layout;
+    std::streampos start;
+    std::vector<StripEntry> strips;
+};
+
+// Lines firstLine, firstLine + lineStep, ... of the image cut to positions first, first + step, ... Sequential files
+// store the image as a single plane, progressive ones as the seven Adam7 passes, each split into strips on its own.
+struct Plane
+{
+    size_t firstLine;
+    size_t lineStep;
+    size_t first;
+    size_t step;
+    size_t lines;
+    size_t length;
+};
+
+constexpr std::array<std::array<size_t, 4>, 7> adam7Passes{
+    std::array<size_t, 4>{0, 8, 0, 8},
+    std::array<size_t, 4>{0, 8, 4, 8},
+    std::array<size_t, 4>{4, 8, 0, 4},
+    std::array<size_t, 4>{0, 4, 2, 4},
+    std::array<size_t, 4>{2, 4, 0, 2},
+    std::array<size_t, 4>{0, 2, 1, 2},
+    std::array<size_t, 4>{1, 2, 0, 1}
+};
+
+std::vector<Plane> getPlanes(const size_t lines, const size_t length, const Layout layout)
+{
+    if (layout == Layout::sequential)
+    {
+        return {Plane{0, 1, 0, 1, lines, length}};
+    }
+
+    std::vector<Plane> planes;
+    for (const auto& [firstLine, lineStep, first, step] : adam7Passes)
+    {
+        planes.push_back(Plane{firstLine, lineStep, first, step,
+                               firstLine < lines ? (lines - firstLine + lineStep - 1) / lineStep : 0,
+                               first < length ? (length - first + step - 1) / step : 0});
+    }
+    return planes;
+}
+
+size_t getStripsCount(const Plane& plane, const size_t stripLines)
+{
+    return (plane.lines + stripLines - 1) / stripLines;
+}
+
+void writeValue(std::ostream& stream, const Uint32 value)
+{
+    const char bytes[4]{static_cast<char>(value), static_cast<char>(value >> 8), static_cast<char>(value >> 16), static_cast<char>(value >> 24)};
+    stream.write(bytes, sizeof(bytes));
+}
+
+void readBytes(std::istream& stream, void* target, const size_t size)
+{
+    if (not stream.read(static_cast<char*>(target), static_cast<std::streamsize>(size)))
+    {
+        throw std::runtime_error("Truncated .gkimg file");
+    }
+}
+
+Uint32 readValue(std::istream& stream)
+{
+    Uint8 bytes[4];
+    readBytes(stream, bytes, sizeof(bytes));
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<Uint32>(bytes[3]) << 24;
+}
+
+std::vector<Uint8> extractPlane(const IndexedImage<defaultBits>& image, const Plane& plane)
+{
+    const size_t lineSize = Format::packedSize(plane.length);
+    std::vector<Uint8> packed(plane.lines * lineSize);
+    std::vector<Uint8> indices(image.length);
+    std::vector<Uint8> planeIndices(plane.length);
+
+    for (size_t line{0}; line < plane.lines; ++line)
+    {
+        Format::unpack(image.indices.data() + (plane.firstLine + line * plane.lineStep) * Format::packedSize(image.length), image.length, indices.data());
+        for (size_t position{0}; position < plane.length; ++position)
+        {
+            planeIndices[position] = indices[plane.first + position * plane.step];
+        }
+        Format::pack(planeIndices.data(), plane.length, packed.data() + line * lineSize);
+    }
+
+    return packed;
+}
+
+Header readHeader(std::istream& stream)
+{
+    Header header{};
+    header.start = stream.tellg();
+
+    char fileMagic[4];
+    Uint8 fileVersion, fileBits;
+    readBytes(stream, fileMagic, sizeof(fileMagic));
+    readBytes(stream, &fileVersion, 1);
+    readBytes(stream, &fileBits, 1);
+
+    if (not std::equal(std::begin(magic), std::end(magic), fileMagic) or fileVersion < 1 or fileVersion > version or fileBits != Format::bits)
+    {
+        throw std::runtime_error("Unsupported .gkimg file");
+    }
+
+    header.image.lines = readValue(stream);
+    header.image.length = readValue(stream);
+    header.stripLines = readValue(stream);
+    header.layout = Layout::sequential;
+
+    if (fileVersion >= 3)
+    {
+        Uint8 layout;
+        readBytes(stream, &layout, 1);
+        header.layout = static_cast<Layout>(layout);
+    }
+
+    if (header.stripLines == 0 or (header.layout != Layout::sequential and header.layout != Layout::progressive))
+    {
+        throw std::runtime_error("Corrupt .gkimg header");
+    }
+
+    for (auto& color : header.image.palette)
+    {
+        Uint8 rgb[3];
+        readBytes(stream, rgb, sizeof(rgb));
+        color = SDL_Color{rgb[0], rgb[1], rgb[2], 1};
+    }
+
+    size_t stripsCount{0};
+    for (const auto& plane : getPlanes(header.image.lines, header.image.length, header.layout))
+    {
+        stripsCount += getStripsCount(plane, header.stripLines);
+    }
+
+    header.strips.resize(stripsCount);
+    for (auto& strip : header.strips)
+    {
+        Uint8 codec;
+        readBytes(stream, &codec, 1);
+        strip.codec = static_cast<Codec>(codec);
+        strip.size = readValue(stream);
+
+        if (fileVersion >= 2)
+        {
+            strip.offset = readValue(stream);
+            strip.offset |= static_cast<uint64_t>(readValue(stream)) << 32;
+        }
+        else
+        {
+            strip.offset = static_cast<uint64_t>(stream.tellg() - header.start);
+            stream.seekg(strip.size, std::ios::cur);
+        }
+    }
+
+    return header;
+}
+
+std::vector<Chunk> readStrips(std::istream& stream, const Header& header, const size_t firstStrip, const size_t count)
+{
+    std::vector<Chunk> strips(count);
+    for (size_t s{0}; s < count; ++s)
+    {
+        const StripEntry& entry = header.strips[firstStrip + s];
+        strips[s] = Chunk{entry.codec, std::vector<Uint8>(entry.size)};
+
+        if (not stream.seekg(header.start + static_cast<std::streamoff>(entry.offset)))
+        {
+            throw std::runtime_error("Corrupt .gkimg strip offset");
+        }
+        readBytes(stream, strips[s].data.data(), entry.size);
+    }
+    return strips;
+}
+
+// Unpacked indices of the whole image, of which only the pixels of the first passes are filled in
+std::vector<Uint8> decodePasses(std::istream& stream, const Header& header, const size_t passes, const unsigned threads)
+{
+    const size_t length = header.image.length;
+    const auto planes = getPlanes(header.image.lines, length, header.layout);
+
+    std::vector<std::pair<size_t, size_t>> stripPlanes;
+    for (size_t p{0}; p < passes; ++p)
+    {
+        for (size_t s{0}; s < getStripsCount(planes[p], header.stripLines); ++s)
+        {
+            stripPlanes.emplace_back(p, s);
+        }
+    }
+
+    const auto strips = readStrips(stream, header, 0, stripPlanes.size());
+    std::vector<Uint8> pixels(header.image.lines * length);
+
+    // Passes never share a pixel, so strips scatter into the image without any locking
+    parallelFor(strips.size(), threads, [&](const size_t begin, const size_t end)
+                    {
+                        std::vector<Uint8> indices(length);
+
+                        for (size_t i{begin}; i < end; ++i)
+                        {
+                            const auto [p, s] = stripPlanes[i];
+                            const Plane& plane = planes[p];
+                            const size_t lineSize = Format::packedSize(plane.length);
+                            const size_t stripFirst = s * header.stripLines;
+                            const size_t stripLines = std::min(header.stripLines, plane.lines - stripFirst);
+                            const auto decoded = decompressChunk(strips[i], stripLines * lineSize);
+
+                            for (size_t line{0}; line < stripLines; ++line)
+                            {
+                                Format::unpack(decoded.data() + line * lineSize, plane.length, indices.data());
+                                Uint8* target = pixels.data() + (plane.firstLine + (stripFirst + line) * plane.lineStep) * length;
+                                for (size_t position{0}; position < plane.length; ++position)
+                                {
+                                    target[plane.first + position * plane.step] = indices[position];
+                                }
+                            }
+                        }
+                    });
+
+    return pixels;
+}
+
+IndexedImage<defaultBits> packPixels(const std::vector<Uint8>& pixels, const Header& header, const size_t firstLine, const size_t lines, const size_t first, const size_t length)
+{
+    IndexedImage<defaultBits> image{header.image.palette, lines, length, {}};
+    const size_t lineSize = Format::packedSize(length);
+    image.indices.resize(lines * lineSize);
+
+    for (size_t line{0}; line < lines; ++line)
+    {
+        Format::pack(pixels.data() + (firstLine + line) * header.image.length + first, length, image.indices.data() + line * lineSize);
+    }
+    return image;
+}
+
+IndexedImage<defaultBits> readRegion(std::istream& stream, const Header& header, const size_t firstLine, const size_t lines, const size_t first, const size_t length, const unsigned threads)
+{
+    const size_t fileLines = header.image.lines;
+    const size_t fileLength = header.image.length;
+
+    if (firstLine > fileLines or lines > fileLines - firstLine or first > fileLength or length > fileLength - first)
+    {
+        throw std::runtime_error("Region outside of the .gkimg image");
+    }
+
+    // Every pass of a progressive file spreads over the whole image, so regions cannot skip any of them
+    if (header.layout == Layout::progressive)
+    {
+        return packPixels(decodePasses(stream, header, adam7Passes.size(), threads), header, firstLine, lines, first, length);
+    }
+
+    IndexedImage<defaultBits> image{header.image.palette, lines, length, {}};
+    const size_t fileLineSize = Format::packedSize(fileLength);
+    const size_t lineSize = Format::packedSize(length);
+    image.indices.resize(lines * lineSize);
+
+    if (lines == 0)
+    {
+        return image;
+    }
+
+    const size_t firstStrip = firstLine / header.stripLines;
+    const size_t lastStrip = (firstLine + lines - 1) / header.stripLines;
+    const auto strips = readStrips(stream, header, firstStrip, lastStrip - firstStrip + 1);
+
+    parallelFor(strips.size(), threads, [&](const size_t begin, const size_t end)
+                    {
+                        std::vector<Uint8> indices(fileLength);
+
+                        for (size_t s{begin}; s < end; ++s)
+                        {
+                            const size_t stripFirst = (firstStrip + s) * header.stripLines;
+                            const size_t stripLines = std::min(header.stripLines, fileLines - stripFirst);
+                            const auto decoded = decompressChunk(strips[s], stripLines * fileLineSize);
+
+                            const size_t from = std::max(stripFirst, firstLine);
+                            const size_t to = std::min(stripFirst + stripLines, firstLine + lines);
+                            for (size_t line{from}; line < to; ++line)
+                            {
+                                const Uint8* source = decoded.data() + (line - stripFirst) * fileLineSize;
+                                Uint8* target = image.indices.data() + (line - firstLine) * lineSize;
+
+                                if (first == 0 and length == fileLength)
+                                {
+                                    std::copy(source, source + lineSize, target);
+                                }
+                                else
+                                {
+                                    Format::unpack(source, fileLength, indices.data());
+                                    Format::pack(indices.data() + first, length, target);
+                                }
+                            }
+                        }
+                    });
+
+    return image;
+}
+}
+
+void writeImageFile(std::ostream& stream, const IndexedImage<defaultBits>& image, const bool progressive, const unsigned threads)
+{
+    const Layout layout = progressive ? Layout::progressive : Layout::sequential;
+    const auto planes = getPlanes(image.lines, image.length, layout);
+
+    std::vector<std::vector<Uint8>> extracted(planes.size());
+    if (layout == Layout::progressive)
+    {
+        parallelFor(planes.size(), threads, [&](const size_t begin, const size_t end)
+                        {
+                            for (size_t p{begin}; p < end; ++p)
+                            {
+                                extracted[p] = extractPlane(image, planes[p]);
+                            }
+                        });
+    }
+
+    std::vector<std::pair<size_t, size_t>> stripPlanes;
+    for (size_t p{0}; p < planes.size(); ++p)
+    {
+        for (size_t s{0}; s < getStripsCount(planes[p], linesPerStrip); ++s)
+        {
+            stripPlanes.emplace_back(p, s);
+        }
+    }
+
+    std::vector<Chunk> strips(stripPlanes.size());
+    parallelFor(strips.size(), threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t i{begin}; i < end; ++i)
+                        {
+                            const auto [p, s] = stripPlanes[i];
+                            const Uint8* data = layout == Layout::progressive ? extracted[p].data() : image.indices.data();
+                            const size_t lineSize = Format::packedSize(planes[p].length);
+                            const size_t first = s * linesPerStrip;
+                            const size_t lines = std::min(linesPerStrip, planes[p].lines - first);
+                            strips[i] = compressChunk(data + first * lineSize, lines * lineSize);
+                        }
+                    });
+
+    stream.write(magic, sizeof(magic));
+    stream.put(static_cast<char>(version));
+    stream.put(static_cast<char>(Format::bits));
+    writeValue(stream, static_cast<Uint32>(image.lines));
+    writeValue(stream, static_cast<Uint32>(image.length));
+    writeValue(stream, static_cast<Uint32>(linesPerStrip));
+    stream.put(static_cast<char>(layout));
+
+    for (const auto& color : image.palette)
+    {
+        stream.put(static_cast<char>(color.r));
+        stream.put(static_cast<char>(color.g));
+        stream.put(static_cast<char>(color.b));
+    }
+
+    constexpr size_t headerSize{sizeof(magic) + 2 + 3 * 4 + 1 + Format::paletteSize * 3};
+    constexpr size_t entrySize{1 + 4 + 8};
+    uint64_t offset{headerSize + strips.size() * entrySize};
+
+    for (const auto& strip : strips)
+    {
+        stream.put(static_cast<char>(strip.codec));
+        writeValue(stream, static_cast<Uint32>(strip.data.size()));
+        writeValue(stream, static_cast<Uint32>(offset));
+        writeValue(stream, static_cast<Uint32>(offset >> 32));
+        offset += strip.data.size();
+    }
+
+    for (const auto& strip : strips)
+    {
+        stream.write(reinterpret_cast<const char*>(strip.data.data()), static_cast<std::streamsize>(strip.data.size()));
+    }
+
+    if (not stream)
+    {
+        throw std::runtime_error("Failed to write .gkimg file");
+    }
+}
+
+IndexedImage<defaultBits> readImageFile(std::istream& stream, const unsigned threads)
+{
+    const Header header = readHeader(stream);
+    return readRegion(stream, header, 0, header.image.lines, 0, header.image.length, threads);
+}
+
+IndexedImage<defaultBits> readImageFileHeader(std::istream& stream)
+{
+    return readHeader(stream).image;
+}
+
+IndexedImage<defaultBits> readImageFileRegion(std::istream& stream, const size_t firstLine, const size_t lines, const size_t first, const size_t length, const unsigned threads)
+{
+    return readRegion(stream, readHeader(stream), firstLine, lines, first, length, threads);
+}
+
+std::optional<IndexedImage<defaultBits>> readImageFilePreview(std::istream& stream, const size_t passes, const unsigned threads)
+{
+    if (passes < 1 or passes > adam7Passes.size())
+    {
+        throw std::runtime_error("A preview is made of 1 to 7 passes");
+    }
+
+    const Header header = readHeader(stream);
+    if (header.layout != Layout::progressive)
+    {
+        return std::nullopt;
+    }
+
+    const size_t lines = header.image.lines;
+    const size_t length = header.image.length;
+    auto pixels = decodePasses(stream, header, passes, threads);
+
+    // Every pixel takes the known one at the top left corner of the block it falls in, which the passes read so far
+    // halve alternately along positions and lines
+    const size_t lineBlock = size_t{8} >> (passes - 1) / 2;
+    const size_t block = size_t{8} >> passes / 2;
+
+    for (size_t line{0}; line < lines; ++line)
+    {
+        const Uint8* source = pixels.data() + (line - line % lineBlock) * length;
+        Uint8* target = pixels.data() + line * length;
+        for (size_t position{0}; position < length; ++position)
+        {
+            target[position] = source[position - position % block];
+        }
+    }
+
+    return packPixels(pixels, header, 0, lines, 0, length);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <iosfwd>
+#include <optional>
+#include "IndexedFormat.hpp"
+
+// .gkimg files hold a palette and the packed palette indices of an image split into strips of lines. Each strip is
+// compressed on its own with whichever codec makes it smallest, so strips are encoded and decoded in parallel.
+// A table of strip offsets follows the palette, so readers can seek straight to the strips they need.
+// Progressive files store the pixels as the seven Adam7 passes, so the first few percent of the strips already give a
+// coarse preview of the whole image. threads == 0 selects std::thread::hardware_concurrency().
+void writeImageFile(std::ostream&, const IndexedImage<defaultBits>&, bool progressive = false, unsigned threads = 0);
+IndexedImage<defaultBits> readImageFile(std::istream&, unsigned threads = 0);
+// Palette and dimensions only, indices are left empty
+IndexedImage<defaultBits> readImageFileHeader(std::istream&);
+// Lines [firstLine, firstLine + lines) cut to positions [first, first + length) of each line. Only the strips holding
+// those lines are read and decoded.
+IndexedImage<defaultBits> readImageFileRegion(std::istream&, size_t firstLine, size_t lines, size_t first, size_t length, unsigned threads = 0);
+// The first passes of a progressive file with every missing pixel copied from the nearest known one above and to the
+// left of it. Two passes read about 3% of the pixels. std::nullopt for files that are not progressive.
+std::optional<IndexedImage<defaultBits>> readImageFilePreview(std::istream&, size_t passes, unsigned threads = 0);
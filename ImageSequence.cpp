@@ -0,0 +1,171 @@
+#include "ImageSequence.hpp"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "ColorIndexCache.hpp"
+#include "MedianCutter.hpp"
+#include "Parallel.hpp"
+
+ImageSequence::ImageSequence(const TransformOptions& options) : options{options},
+    frameLines{0},
+    framesCount{0},
+    palette{},
+    reusedTilesCount{0}
+{}
+
+void ImageSequence::addFrame(std::vector<std::vector<SDL_Color>> frame)
+{
+    if (frame.empty() or frame[0].empty())
+    {
+        throw std::runtime_error("Empty sequence frame");
+    }
+    if (framesCount > 0 and (frame.size() != frameLines or frame[0].size() != lines[0].size()))
+    {
+        throw std::runtime_error("Frames of a sequence must share their size");
+    }
+
+    frameLines = frame.size();
+    lines.insert(lines.end(), std::make_move_iterator(frame.begin()), std::make_move_iterator(frame.end()));
+    ++framesCount;
+}
+
+size_t ImageSequence::getFramesCount() const
+{
+    return framesCount;
+}
+
+size_t ImageSequence::getReusedTilesCount() const
+{
+    return reusedTilesCount;
+}
+
+const Palette& ImageSequence::buildPalette()
+{
+    if (framesCount == 0)
+    {
+        throw std::runtime_error("Sequence has no frames");
+    }
+
+    MedianCutter<> medianCutter{lines, palette, options};
+    medianCutter.buildPalette(false);
+    return palette;
+}
+
+bool ImageSequence::isTileUnchanged(const size_t frame, const size_t firstLine, const size_t first) const
+{
+    const size_t current = frame * frameLines;
+    const size_t previous = current - frameLines;
+    const size_t lastLine = std::min(firstLine + tileSize, frameLines);
+    const size_t last = std::min(first + tileSize, lines[0].size());
+
+    for (size_t x{firstLine}; x < lastLine; ++x)
+    {
+        for (size_t y{first}; y < last; ++y)
+        {
+            const SDL_Color& lhs = lines[current + x][y];
+            const SDL_Color& rhs = lines[previous + x][y];
+            if (lhs.r != rhs.r or lhs.g != rhs.g or lhs.b != rhs.b)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<IndexedImage<defaultBits>> ImageSequence::perform()
+{
+    using Format = IndexedFormat<defaultBits>;
+
+    buildPalette();
+
+    const size_t length = lines[0].size();
+    const size_t tileLines = (frameLines + tileSize - 1) / tileSize;
+    const size_t tilePositions = (length + tileSize - 1) / tileSize;
+    const size_t tilesCount = tileLines * tilePositions;
+
+    std::vector<std::vector<Uint8>> planes(framesCount, std::vector<Uint8>(frameLines * length));
+    std::vector<Uint8> reused(framesCount * tilesCount, 0);
+
+    const ColorConverter converter{options.colorMetric};
+    const PaletteSearch paletteSearch{palette.data(), palette.size(), converter};
+
+    expectProgress(options.control, framesCount);
+    parallelFor(framesCount, options.threads, [&](const size_t begin, const size_t end)
+                    {
+                        ColorIndexCache cache;
+                        const auto search = [&converter, &paletteSearch](const SDL_Color& color)
+                        {
+                            return paletteSearch.find(converter.convert(color));
+                        };
+
+                        for (size_t f{begin}; f < end; ++f)
+                        {
+                            checkCancelled(options.control);
+
+                            for (size_t tile{0}; tile < tilesCount; ++tile)
+                            {
+                                const size_t firstLine = tile / tilePositions * tileSize;
+                                const size_t first = tile % tilePositions * tileSize;
+
+                                if (f > 0 and isTileUnchanged(f, firstLine, first))
+                                {
+                                    reused[f * tilesCount + tile] = 1;
+                                    continue;
+                                }
+
+                                for (size_t x{firstLine}; x < std::min(firstLine + tileSize, frameLines); ++x)
+                                {
+                                    for (size_t y{first}; y < std::min(first + tileSize, length); ++y)
+                                    {
+                                        planes[f][x * length + y] = static_cast<Uint8>(cache.find(lines[f * frameLines + x][y], search));
+                                    }
+                                }
+                            }
+
+                            reportProgress(options.control);
+                        }
+                    });
+
+    // A reused tile copies the frame before it, which holds the tile either mapped or copied in turn, so each tile
+    // walks the frames in order
+    parallelFor(tilesCount, options.threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t tile{begin}; tile < end; ++tile)
+                        {
+                            const size_t firstLine = tile / tilePositions * tileSize;
+                            const size_t first = tile % tilePositions * tileSize;
+                            const size_t last = std::min(first + tileSize, length);
+
+                            for (size_t f{1}; f < framesCount; ++f)
+                            {
+                                if (not reused[f * tilesCount + tile])
+                                {
+                                    continue;
+                                }
+                                for (size_t x{firstLine}; x < std::min(firstLine + tileSize, frameLines); ++x)
+                                {
+                                    std::copy(planes[f - 1].begin() + x * length + first, planes[f - 1].begin() + x * length + last, planes[f].begin() + x * length + first);
+                                }
+                            }
+                        }
+                    });
+
+    reusedTilesCount = static_cast<size_t>(std::count(reused.begin(), reused.end(), 1));
+
+    std::vector<IndexedImage<defaultBits>> images(framesCount);
+    const size_t lineSize = Format::packedSize(length);
+    parallelFor(framesCount, options.threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t f{begin}; f < end; ++f)
+                        {
+                            images[f] = IndexedImage<defaultBits>{palette, frameLines, length, std::vector<Uint8>(frameLines * lineSize)};
+                            for (size_t x{0}; x < frameLines; ++x)
+                            {
+                                Format::pack(planes[f].data() + x * length, length, images[f].indices.data() + x * lineSize);
+                            }
+                        }
+                    });
+
+    return images;
+}
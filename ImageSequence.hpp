@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <SDL2/SDL.h>
+#include "IndexedFormat.hpp"
+#include "TransformOptions.hpp"
+
+// Frames of one size quantized to a single palette, so colors do not flicker from frame to frame. The palette is a
+// median cut of the pixels of all frames, so each color weighs as much as it occurs, and it follows the color metric,
+// linear light and sampling of the options. Frames are mapped in parallel, and tiles identical to the same tile of the
+// previous frame take its indices instead of being mapped again.
+class ImageSequence
+{
+public:
+    explicit ImageSequence(const TransformOptions& options = TransformOptions{});
+
+    // Frames are kept whole until perform, since no frame can be mapped before the palette has seen all of them
+    void addFrame(std::vector<std::vector<SDL_Color>> frame);
+    size_t getFramesCount() const;
+
+    const Palette& buildPalette();
+    // Builds the palette and maps every frame onto it
+    std::vector<IndexedImage<defaultBits>> perform();
+    // Tiles of the last perform taken over from the previous frame
+    size_t getReusedTilesCount() const;
+
+private:
+    static constexpr size_t tileSize{16};
+
+    TransformOptions options;
+    // Lines of all frames one after another, which the median cut takes as a single image
+    std::vector<std::vector<SDL_Color>> lines;
+    size_t frameLines;
+    size_t framesCount;
+    Palette palette;
+    size_t reusedTilesCount;
+
+    bool isTileUnchanged(size_t, size_t, size_t) const;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <SDL2/SDL.h>
+
+// Palette storage and index packing for an output of Bits bits per pixel. Packed lines start on a byte
+// boundary and keep the first pixel in the most significant bits.
+template <unsigned Bits>
+struct IndexedFormat
+{
+    static_assert(Bits == 1 or Bits == 2 or Bits == 4 or Bits == 8, "Supported depths are 1, 2, 4 and 8 bits per pixel");
+
+    static constexpr unsigned bits{Bits};
+    static constexpr size_t paletteSize{size_t{1} << Bits};
+    static constexpr size_t pixelsPerByte{8 / Bits};
+    static constexpr Uint8 mask{static_cast<Uint8>(paletteSize - 1)};
+
+    using Palette = std::array<SDL_Color, paletteSize>;
+
+    static constexpr size_t packedSize(const size_t count)
+    {
+        return (count + pixelsPerByte - 1) / pixelsPerByte;
+    }
+
+    static void pack(const Uint8* indices, const size_t count, Uint8* packed)
+    {
+        if constexpr (Bits == 8)
+        {
+            std::memcpy(packed, indices, count);
+        }
+        else
+        {
+            const size_t whole = count / pixelsPerByte;
+            for (size_t i{0}; i < whole; ++i, indices += pixelsPerByte)
+            {
+                Uint8 byte{0};
+                for (size_t j{0}; j < pixelsPerByte; ++j)
+                {
+                    byte = static_cast<Uint8>(byte << Bits | (indices[j] & mask));
+                }
+                packed[i] = byte;
+            }
+
+            if (const size_t rest = count % pixelsPerByte; rest > 0)
+            {
+                Uint8 byte{0};
+                for (size_t j{0}; j < pixelsPerByte; ++j)
+                {
+                    byte = static_cast<Uint8>(byte << Bits | (j < rest ? indices[j] & mask : 0));
+                }
+                packed[whole] = byte;
+            }
+        }
+    }
+
+    static void unpack(const Uint8* packed, const size_t count, Uint8* indices)
+    {
+        if constexpr (Bits == 8)
+        {
+            std::memcpy(indices, packed, count);
+        }
+        else
+        {
+            for (size_t i{0}; i < count; ++i)
+            {
+                const unsigned shift = 8 - Bits * (i % pixelsPerByte + 1);
+                indices[i] = static_cast<Uint8>(packed[i / pixelsPerByte] >> shift & mask);
+            }
+        }
+    }
+};
+
+constexpr unsigned defaultBits = 4;
+
+using Palette = IndexedFormat<defaultBits>::Palette;
+
+// Palette and packed index lines of an image quantized to Bits bits per pixel
+template <unsigned Bits>
+struct IndexedImage
+{
+    typename IndexedFormat<Bits>::Palette palette;
+    size_t lines;
+    size_t length;
+    std::vector<Uint8> indices;
+};
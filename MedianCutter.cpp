@@ -0,0 +1,519 @@
+#include "MedianCutter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include "ColorIndexCache.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+// Scale of linear light averages in channel units
+constexpr double linearToChannel = 255.0 / 65535.0;
+
+int channel(const SDL_Color& color, const size_t axis)
+{
+    return axis == 0 ? color.r : axis == 1 ? color.g : color.b;
+}
+
+int channel(const MetricColor& color, const size_t axis)
+{
+    return color[axis];
+}
+}
+
+template <unsigned Bits>
+MedianCutter<Bits>::MedianCutter(const std::vector<std::vector<SDL_Color>>& image, Palette& palette, const TransformOptions& options) : image{image},
+    palette{palette},
+    sampleSize{options.paletteSampleSize},
+    seed{options.paletteSampleSeed},
+    converter{options.colorMetric},
+    linearLight{options.linearLight},
+    threads{options.threads},
+    forkLevels{0},
+    control{options.control},
+    errorBounds{},
+    greyHistogram{},
+    greyCounts{},
+    greySums{},
+    greySquares{},
+    greyIndices{}
+{}
+
+template <unsigned Bits>
+Uint8 MedianCutter<Bits>::getGrey(const SDL_Color& pixel, const bool linearLight)
+{
+    if (linearLight)
+    {
+        return getLinearLuma(pixel, getSrgbToLinearTable(), getLinearToSrgbTable());
+    }
+    return static_cast<Uint8>(0.299 * pixel.r + 0.587 * pixel.g + 0.114 * pixel.b);
+}
+
+template <unsigned Bits>
+void MedianCutter<Bits>::collectSamples(const bool greyscale)
+{
+    const size_t length = image[0].size();
+    const size_t total = image.size() * length;
+
+    size_t count = total;
+    if (sampleSize != 0 and sampleSize < total)
+    {
+        count = std::max(sampleSize, std::min(total, Format::paletteSize));
+    }
+
+    const bool perceptual = converter.getMetric() != ColorMetric::rgb;
+
+    colors.clear();
+    points.clear();
+    greyHistogram.fill(0);
+    if (perceptual and not greyscale)
+    {
+        points.reserve(count);
+    }
+    else
+    {
+        colors.reserve(count);
+    }
+
+    const auto add = [this, greyscale, perceptual](const SDL_Color& pixel)
+    {
+        if (greyscale)
+        {
+            ++greyHistogram[getGrey(pixel, linearLight)];
+        }
+        else if (perceptual)
+        {
+            points.emplace_back(converter.convert(pixel));
+        }
+        else
+        {
+            colors.emplace_back(pixel);
+        }
+    };
+
+    if (count == total)
+    {
+        expectProgress(control, image.size());
+        for (const auto& row : image)
+        {
+            checkCancelled(control);
+            for (const auto& pixel : row)
+            {
+                add(pixel);
+            }
+            reportProgress(control);
+        }
+    }
+    else
+    {
+        std::mt19937_64 generator{seed};
+        for (size_t stratum{0}; stratum < count; ++stratum)
+        {
+            const size_t begin = stratum * total / count;
+            const size_t end = (stratum + 1) * total / count;
+            const size_t index = begin + generator() % (end - begin);
+            add(image[index / length][index % length]);
+        }
+    }
+
+    sampling = PaletteSampling{count, total, 0.0};
+}
+
+// Widens the bound of a palette slot by the confidence half-width of a bucket average, with the finite population
+// correction for sampling without replacement
+template <unsigned Bits>
+void MedianCutter<Bits>::updateErrorBound(const size_t slot, const size_t count, const double sum, const double sumOfSquares)
+{
+    if (count < 2 or sampling.sampledPixels >= sampling.totalPixels)
+    {
+        return;
+    }
+
+    const double mean = sum / count;
+    const double variance = std::max(0.0, (sumOfSquares - mean * sum) / (count - 1));
+    const double correction = 1.0 - static_cast<double>(sampling.sampledPixels) / sampling.totalPixels;
+
+    errorBounds[slot] = std::max(errorBounds[slot], 1.96 * std::sqrt(variance / count * correction));
+}
+
+template <unsigned Bits>
+const PaletteSampling& MedianCutter<Bits>::getSampling() const
+{
+    return sampling;
+}
+
+template <unsigned Bits>
+void MedianCutter<Bits>::buildPalette(const bool greyscale)
+{
+    search.reset();
+    collectSamples(greyscale);
+    errorBounds.fill(0.0);
+
+    // Halves are cut on their own threads down to the level with at least as many buckets as threads
+    const unsigned workers = threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threads;
+    forkLevels = 0;
+    while (forkLevels < Bits and (1u << forkLevels) < workers)
+    {
+        ++forkLevels;
+    }
+
+    if (greyscale)
+    {
+        cutGreys();
+        return;
+    }
+
+    if (converter.getMetric() != ColorMetric::rgb)
+    {
+        medianCut(points, 0, points.size() - 1, Bits, 0);
+        search.emplace(palette.data(), palette.size(), converter);
+    }
+    else
+    {
+        medianCut(colors, 0, colors.size() - 1, Bits, 0);
+    }
+
+    sampling.errorBound = *std::max_element(errorBounds.begin(), errorBounds.end());
+}
+
+template <unsigned Bits>
+void MedianCutter<Bits>::buildGreyscalePalette(const GreyHistogram& histogram)
+{
+    search.reset();
+    greyHistogram = histogram;
+    const size_t total = image.size() * image[0].size();
+    sampling = PaletteSampling{total, total, 0.0};
+    errorBounds.fill(0.0);
+
+    cutGreys();
+}
+
+template <unsigned Bits>
+const typename MedianCutter<Bits>::GreyHistogram& MedianCutter<Bits>::getGreyHistogram() const
+{
+    return greyHistogram;
+}
+
+// Splits of the top fork levels run on two threads when the bucket is large enough to pay for one
+template <unsigned Bits>
+bool MedianCutter<Bits>::shouldFork(const size_t start, const size_t end, const unsigned iteration) const
+{
+    constexpr size_t minimumForkSize{size_t{1} << 14};
+    return Bits - iteration < forkLevels and end - start + 1 >= minimumForkSize;
+}
+
+template <unsigned Bits>
+std::vector<std::vector<SDL_Color>> MedianCutter<Bits>::perform(const bool greyscale)
+{
+    buildPalette(greyscale);
+    return map(image, greyscale);
+}
+
+template <unsigned Bits>
+std::vector<std::vector<SDL_Color>> MedianCutter<Bits>::map(const std::vector<std::vector<SDL_Color>>& target, const bool greyscale) const
+{
+    auto transformedImage = target;
+    ColorIndexCache cache;
+    const auto search = [this](const SDL_Color& color)
+    {
+        return findNeighbourColor(color);
+    };
+
+    expectProgress(control, transformedImage.size());
+    for (auto& row : transformedImage)
+    {
+        checkCancelled(control);
+        for (auto& pixel : row)
+        {
+            pixel = palette[greyscale ? findNeighbourGreyscale(pixel) : cache.find(pixel, search)];
+        }
+        reportProgress(control);
+    }
+
+    return transformedImage;
+}
+
+template <unsigned Bits>
+std::vector<Uint8> MedianCutter<Bits>::performIndexed(const bool greyscale)
+{
+    buildPalette(greyscale);
+
+    const size_t length = image[0].size();
+    const size_t packedLength = Format::packedSize(length);
+
+    std::vector<Uint8> indices(length);
+    std::vector<Uint8> packed(image.size() * packedLength);
+    ColorIndexCache cache;
+    const auto search = [this](const SDL_Color& color)
+    {
+        return findNeighbourColor(color);
+    };
+
+    expectProgress(control, image.size());
+    for (size_t x{0}; x < image.size(); ++x)
+    {
+        checkCancelled(control);
+        for (size_t y{0}; y < length; ++y)
+        {
+            indices[y] = static_cast<Uint8>(greyscale ? findNeighbourGreyscale(image[x][y]) : cache.find(image[x][y], search));
+        }
+        Format::pack(indices.data(), length, packed.data() + x * packedLength);
+        reportProgress(control);
+    }
+
+    return packed;
+}
+
+template <unsigned Bits>
+template <typename Color>
+void MedianCutter<Bits>::medianCut(std::vector<Color>& bucket, const size_t start, const size_t end, const unsigned iteration, const size_t slot)
+{
+    checkCancelled(control);
+
+    // A single pixel cannot be split any further, so every slot under it takes its color
+    if (iteration > 0 and start == end)
+    {
+        medianCut(bucket, start, end, 0, slot);
+        std::fill_n(palette.begin() + slot + 1, (size_t{1} << iteration) - 1, palette[slot]);
+        return;
+    }
+
+    if (iteration > 0)
+    {
+        sortBucket(bucket, start, end, greatestDifference(bucket, start, end));
+
+        const size_t medium = (start + end + 1) / 2;
+
+        parallelInvoke(shouldFork(start, end, iteration), [&]
+                           {
+                               medianCut(bucket, start, medium - 1, iteration - 1, slot);
+                           },
+                       [&]
+                           {
+                               medianCut(bucket, medium, end, iteration - 1, slot + (size_t{1} << (iteration - 1)));
+                           });
+        return;
+    }
+
+    const bool linear = linearLight and std::is_same_v<Color, SDL_Color>;
+    const auto& toLinear = getSrgbToLinearTable();
+
+    std::array<int64_t, 3> sums{};
+    std::array<int64_t, 3> squares{};
+
+    for (size_t p{start}; p <= end; ++p)
+    {
+        for (size_t axis{0}; axis < 3; ++axis)
+        {
+            const int64_t value = linear ? toLinear[channel(bucket[p], axis)] : channel(bucket[p], axis);
+            sums[axis] += value;
+            squares[axis] += value * value;
+        }
+    }
+
+    const int64_t count = end - start + 1;
+    const double scale = linear ? linearToChannel : 1.0;
+
+    for (size_t axis{0}; axis < 3; ++axis)
+    {
+        updateErrorBound(slot, count, sums[axis] * scale, squares[axis] * scale * scale);
+    }
+
+    if constexpr (std::is_same_v<Color, SDL_Color>)
+    {
+        if (linear)
+        {
+            const auto& toSrgb = getLinearToSrgbTable();
+            palette[slot] = SDL_Color{toSrgb[sums[0] / count >> 4], toSrgb[sums[1] / count >> 4], toSrgb[sums[2] / count >> 4], 1};
+        }
+        else
+        {
+            palette[slot] = SDL_Color{static_cast<Uint8>(sums[0] / count), static_cast<Uint8>(sums[1] / count), static_cast<Uint8>(sums[2] / count), 1};
+        }
+    }
+    else
+    {
+        palette[slot] = converter.toSdlColor({static_cast<double>(sums[0]) / count,
+                                                        static_cast<double>(sums[1]) / count,
+                                                        static_cast<double>(sums[2]) / count});
+    }
+}
+
+// Axis with the widest range of values in the bucket, the earlier one on ties
+template <unsigned Bits>
+template <typename Color>
+size_t MedianCutter<Bits>::greatestDifference(const std::vector<Color>& bucket, const size_t start, const size_t end) const
+{
+    std::array<int, 3> minimum{}, maximum{};
+
+    for (size_t axis{0}; axis < 3; ++axis)
+    {
+        minimum[axis] = maximum[axis] = channel(bucket[start], axis);
+    }
+
+    for (auto i{start}; i <= end; ++i)
+    {
+        for (size_t axis{0}; axis < 3; ++axis)
+        {
+            minimum[axis] = std::min(minimum[axis], channel(bucket[i], axis));
+            maximum[axis] = std::max(maximum[axis], channel(bucket[i], axis));
+        }
+    }
+
+    size_t widest{0};
+    for (size_t axis{1}; axis < 3; ++axis)
+    {
+        if (maximum[axis] - minimum[axis] > maximum[widest] - minimum[widest])
+        {
+            widest = axis;
+        }
+    }
+    return widest;
+}
+
+template <unsigned Bits>
+template <typename Color>
+void MedianCutter<Bits>::sortBucket(std::vector<Color>& bucket, const size_t start, const size_t end, const size_t axis)
+{
+    std::sort(bucket.begin() + start, bucket.begin() + end + 1, [axis](const Color& lhs, const Color& rhs)
+                  {
+                      return channel(lhs, axis) < channel(rhs, axis);
+                  });
+}
+
+template <unsigned Bits>
+size_t MedianCutter<Bits>::findNeighbourColor(const SDL_Color color) const
+{
+    if (search)
+    {
+        return search->find(converter.convert(color));
+    }
+
+    int minimum{std::numeric_limits<int>::max()};
+    size_t minimumIndex{};
+
+    for (size_t i{0}; i < Format::paletteSize; ++i)
+    {
+        const auto& [paletteColorR, paletteColorG, paletteColorB, _] = palette[i];
+
+        if (const int distance = (color.r - paletteColorR) * (color.r - paletteColorR) +
+                                 (color.g - paletteColorG) * (color.g - paletteColorG) +
+                                 (color.b - paletteColorB) * (color.b - paletteColorB); distance < minimum)
+        {
+            minimum = distance;
+            minimumIndex = i;
+        }
+    }
+
+    return minimumIndex;
+}
+
+// The cut takes a few steps for each of the 256 greys however many pixels were counted
+template <unsigned Bits>
+void MedianCutter<Bits>::cutGreys()
+{
+    accumulateGreys();
+    medianCutGreyscale(0, sampling.sampledPixels - 1, Bits, 0);
+    mapGreys();
+
+    sampling.errorBound = *std::max_element(errorBounds.begin(), errorBounds.end());
+}
+
+// Prefix counts and sums of the histogram, so that any range of the sorted greys can be summed without the greys
+template <unsigned Bits>
+void MedianCutter<Bits>::accumulateGreys()
+{
+    const auto& toLinear = getSrgbToLinearTable();
+
+    greyCounts[0] = greySums[0] = greySquares[0] = 0;
+    for (size_t grey{0}; grey < greyHistogram.size(); ++grey)
+    {
+        const uint64_t value = linearLight ? toLinear[grey] : grey;
+        greyCounts[grey + 1] = greyCounts[grey] + greyHistogram[grey];
+        greySums[grey + 1] = greySums[grey] + greyHistogram[grey] * value;
+        greySquares[grey + 1] = greySquares[grey] + greyHistogram[grey] * value * value;
+    }
+}
+
+// Sum and sum of squares of the count darkest sampled greys
+template <unsigned Bits>
+std::pair<uint64_t, uint64_t> MedianCutter<Bits>::sumDarkestGreys(const size_t count) const
+{
+    const size_t grey = std::upper_bound(greyCounts.begin(), greyCounts.end(), count) - greyCounts.begin() - 1;
+    if (grey >= greyHistogram.size())
+    {
+        return {greySums.back(), greySquares.back()};
+    }
+
+    const uint64_t value = linearLight ? getSrgbToLinearTable()[grey] : grey;
+    const uint64_t remainder = count - greyCounts[grey];
+    return {greySums[grey] + remainder * value, greySquares[grey] + remainder * value * value};
+}
+
+// Works on positions in the sorted greys, which the histogram already describes, so buckets need no sorting
+template <unsigned Bits>
+void MedianCutter<Bits>::medianCutGreyscale(const size_t start, const size_t end, const unsigned iteration, const size_t slot)
+{
+    // A single grey fills every slot under it
+    if (iteration > 0 and start == end)
+    {
+        medianCutGreyscale(start, end, 0, slot);
+        std::fill_n(palette.begin() + slot + 1, (size_t{1} << iteration) - 1, palette[slot]);
+        return;
+    }
+
+    if (iteration > 0)
+    {
+        const size_t medium = (start + end + 1) / 2;
+
+        medianCutGreyscale(start, medium - 1, iteration - 1, slot);
+        medianCutGreyscale(medium, end, iteration - 1, slot + (size_t{1} << (iteration - 1)));
+        return;
+    }
+
+    const auto [sumBefore, squaresBefore] = sumDarkestGreys(start);
+    const auto [sumThrough, squaresThrough] = sumDarkestGreys(end + 1);
+    const uint64_t sumGrey = sumThrough - sumBefore;
+    const uint64_t squaresGrey = squaresThrough - squaresBefore;
+
+    const double scale = linearLight ? linearToChannel : 1.0;
+    updateErrorBound(slot, end - start + 1, sumGrey * scale, squaresGrey * scale * scale);
+
+    const Uint8 newGrey = linearLight ? getLinearToSrgbTable()[sumGrey / (end - start + 1) >> 4] : static_cast<Uint8>(sumGrey / (end - start + 1));
+    palette[slot] = SDL_Color{newGrey, newGrey, newGrey, 1};
+}
+
+// Nearest palette entry of every grey, the first one on ties
+template <unsigned Bits>
+void MedianCutter<Bits>::mapGreys()
+{
+    for (size_t grey{0}; grey < greyIndices.size(); ++grey)
+    {
+        int min{std::numeric_limits<int>::max()};
+
+        for (size_t i{0}; i < Format::paletteSize; ++i)
+        {
+            if (const int distance = std::abs(static_cast<int>(grey) - palette[i].r); distance < min)
+            {
+                min = distance;
+                greyIndices[grey] = static_cast<Uint8>(i);
+            }
+        }
+    }
+}
+
+template <unsigned Bits>
+size_t MedianCutter<Bits>::findNeighbourGreyscale(const SDL_Color color) const
+{
+    return greyIndices[getGrey(color, linearLight)];
+}
+
+template class MedianCutter<1>;
+template class MedianCutter<2>;
+template class MedianCutter<4>;
+template class MedianCutter<8>;
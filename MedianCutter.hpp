@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "ColorSpace.hpp"
+#include "IndexedFormat.hpp"
+#include "TaskControl.hpp"
+#include "TransformOptions.hpp"
+
+// How well a palette built from a sample of the pixels represents the whole image
+struct PaletteSampling
+{
+    size_t sampledPixels{0};
+    size_t totalPixels{0};
+    // Largest 95% confidence half-width, in channel units of the color metric, between a palette entry and the average of its bucket
+    // over every pixel. It covers the bucket averages, not where the buckets were split.
+    double errorBound{0.0};
+};
+
+// Splits the colors of an image into 2^Bits buckets of equal population and uses their averages as the palette
+template <unsigned Bits = defaultBits>
+class MedianCutter
+{
+public:
+    using Format = IndexedFormat<Bits>;
+    using Palette = typename Format::Palette;
+    using GreyHistogram = std::array<uint64_t, 256>;
+
+    // A paletteSampleSize of 0 builds the palette from every pixel, otherwise from one random pixel per each of
+    // paletteSampleSize equal strata of the image. Buckets are split and averaged in the space of colorMetric.
+    MedianCutter(const std::vector<std::vector<SDL_Color>>& image, Palette& palette, const TransformOptions& options = TransformOptions{});
+
+    std::vector<std::vector<SDL_Color>> perform(bool);
+    // Packed palette indices, line by line
+    std::vector<Uint8> performIndexed(bool);
+    void buildPalette(bool);
+    // Greyscale palette from the histogram of greys of every pixel, which is kept up to date elsewhere
+    void buildGreyscalePalette(const GreyHistogram&);
+    // Histogram of the greys the last greyscale palette was built from
+    const GreyHistogram& getGreyHistogram() const;
+    // Nearest entries of the palette built last, for pixels of any image
+    std::vector<std::vector<SDL_Color>> map(const std::vector<std::vector<SDL_Color>>&, bool) const;
+    const PaletteSampling& getSampling() const;
+
+    static Uint8 getGrey(const SDL_Color&, bool linearLight);
+
+private:
+    const std::vector<std::vector<SDL_Color>>& image;
+    Palette& palette;
+    size_t sampleSize;
+    uint64_t seed;
+    ColorConverter converter;
+    bool linearLight;
+    unsigned threads;
+    unsigned forkLevels;
+    TaskControl* control;
+    // Each leaf of the cut owns the palette slot and the error bound at the same index, so halves can be cut
+    // concurrently and still give the same palette
+    std::array<double, Format::paletteSize> errorBounds;
+    std::optional<PaletteSearch> search;
+    PaletteSampling sampling;
+    std::vector<SDL_Color> colors;
+    std::vector<MetricColor> points;
+    // Greyscale cut works on the histogram of greys and its prefix counts and sums
+    GreyHistogram greyHistogram;
+    std::array<uint64_t, 257> greyCounts;
+    std::array<uint64_t, 257> greySums;
+    std::array<uint64_t, 257> greySquares;
+    std::array<Uint8, 256> greyIndices;
+
+    void collectSamples(bool);
+    void updateErrorBound(size_t, size_t, double, double);
+    bool shouldFork(size_t, size_t, unsigned) const;
+
+    void cutGreys();
+    void accumulateGreys();
+    std::pair<uint64_t, uint64_t> sumDarkestGreys(size_t) const;
+    void medianCutGreyscale(size_t, size_t, unsigned, size_t);
+    void mapGreys();
+    size_t findNeighbourGreyscale(SDL_Color) const;
+
+    template <typename Color>
+    void medianCut(std::vector<Color>&, size_t, size_t, unsigned, size_t);
+    template <typename Color>
+    size_t greatestDifference(const std::vector<Color>&, size_t, size_t) const;
+    template <typename Color>
+    void sortBucket(std::vector<Color>&, size_t, size_t, size_t);
+    size_t findNeighbourColor(SDL_Color) const;
+};
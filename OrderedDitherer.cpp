@@ -0,0 +1,237 @@
+#include "OrderedDitherer.hpp"
+#include <algorithm>
+#include "ColorSpace.hpp"
+#include "Parallel.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+constexpr size_t chunkSize = 16;
+
+template <int Levels>
+struct Quantizer
+{
+    static_assert(Levels >= 2 and 255 % (Levels - 1) == 0, "Levels must split 0..255 into equal steps");
+
+    static constexpr int step = 255 / (Levels - 1);
+    // value * magic >> 16 == value / step for every byte, so the division vectorizes as a multiply
+    static constexpr int magic = (65536 + step - 1) / step;
+
+    static constexpr bool isMagicExact()
+    {
+        for (int value{0}; value < 256; ++value)
+        {
+            if ((value * magic) >> 16 != value / step)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(isMagicExact(), "Division by step cannot be replaced with a multiplication");
+};
+
+// Thresholds of one pattern column, repeated to a multiple of the chunk size and scaled to the distance
+// between two levels. Every chunk of a line then starts at a whole period of the column.
+template <typename Pattern>
+constexpr size_t thresholdsPeriod = Pattern::size > chunkSize ? Pattern::size : chunkSize;
+
+template <int Levels, typename Pattern>
+constexpr std::array<Uint8, Pattern::size * thresholdsPeriod<Pattern>> makeThresholds()
+{
+    constexpr size_t period = thresholdsPeriod<Pattern>;
+    static_assert(period % Pattern::size == 0 and period % chunkSize == 0);
+
+    std::array<Uint8, Pattern::size * period> thresholds{};
+    for (size_t column{0}; column < Pattern::size; ++column)
+    {
+        for (size_t i{0}; i < period; ++i)
+        {
+            thresholds[column * period + i] = static_cast<Uint8>((2 * Pattern::values[i % Pattern::size][column] + 1) * Quantizer<Levels>::step / (2 * Pattern::ranks));
+        }
+    }
+    return thresholds;
+}
+
+constexpr std::array<Uint8, 256> makeIdentity()
+{
+    std::array<Uint8, 256> identity{};
+    for (size_t value{0}; value < identity.size(); ++value)
+    {
+        identity[value] = static_cast<Uint8>(value);
+    }
+    return identity;
+}
+
+constexpr std::array<Uint8, 256> identityPositions = makeIdentity();
+
+// Moves every byte to where it lies between the two levels around it in linear light, keeping it between those
+// levels. quantizePlane then compares the thresholds with linear light without any change to its arithmetic.
+template <int Levels>
+const std::array<Uint8, 256>& getLinearPositions()
+{
+    static const std::array<Uint8, 256> positions = []
+    {
+        constexpr int step = Quantizer<Levels>::step;
+        const auto& linear = getSrgbToLinearTable();
+
+        std::array<Uint8, 256> result{};
+        for (int value{0}; value < 256; ++value)
+        {
+            const int lower = value / step * step;
+            const int upper = std::min(lower + step, 255);
+            const int range = linear[upper] - linear[lower];
+
+            result[value] = static_cast<Uint8>(range == 0 ? value : lower + (step * (linear[value] - linear[lower]) + range / 2) / range);
+        }
+        return result;
+    }();
+    return positions;
+}
+
+template <int Levels, size_t Period>
+void quantizePlane(const Uint8* source, Uint8* target, const size_t count, const Uint8* thresholds)
+{
+    constexpr int step = Quantizer<Levels>::step;
+    size_t i{0};
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i magic = _mm_set1_epi16(Quantizer<Levels>::magic);
+    const __m128i steps = _mm_set1_epi16(step);
+
+    const auto quantize = [&](const __m128i value, const __m128i limit)
+    {
+        const __m128i base = _mm_mulhi_epu16(value, magic);
+        const __m128i fraction = _mm_sub_epi16(value, _mm_mullo_epi16(base, steps));
+        const __m128i level = _mm_sub_epi16(base, _mm_cmpgt_epi16(fraction, limit));
+        return _mm_mullo_epi16(level, steps);
+    };
+
+    for (; i + chunkSize <= count; i += chunkSize)
+    {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        const __m128i threshold = _mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds + i % Period));
+        const __m128i low = quantize(_mm_unpacklo_epi8(value, zero), _mm_unpacklo_epi8(threshold, zero));
+        const __m128i high = quantize(_mm_unpackhi_epi8(value, zero), _mm_unpackhi_epi8(threshold, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        const int base = source[i] / step;
+        const int level = base + (source[i] - base * step > thresholds[i % Period]);
+        target[i] = static_cast<Uint8>(level * step);
+    }
+}
+}
+
+template <typename Pattern, typename Output>
+OrderedDitherer<Pattern, Output>::OrderedDitherer(const std::vector<std::vector<SDL_Color>>& image, const unsigned threads, const bool linearLight, TaskControl* const control) : image{image},
+    threads{threads},
+    linearLight{linearLight},
+    control{control}
+{}
+
+template <typename Pattern, typename Output>
+std::vector<std::vector<SDL_Color>> OrderedDitherer<Pattern, Output>::perform() const
+{
+    constexpr size_t period = thresholdsPeriod<Pattern>;
+    static constexpr auto thresholdsR = makeThresholds<Output::levels[0], Pattern>();
+    static constexpr auto thresholdsG = makeThresholds<Output::levels[1], Pattern>();
+    static constexpr auto thresholdsB = makeThresholds<Output::levels[2], Pattern>();
+
+    const auto& positionsR = linearLight ? getLinearPositions<Output::levels[0]>() : identityPositions;
+    const auto& positionsG = linearLight ? getLinearPositions<Output::levels[1]>() : identityPositions;
+    const auto& positionsB = linearLight ? getLinearPositions<Output::levels[2]>() : identityPositions;
+    const auto& toLinear = getSrgbToLinearTable();
+    const auto& toSrgb = getLinearToSrgbTable();
+
+    auto transformedImage = image;
+    const size_t length = image.empty() ? 0 : image[0].size();
+
+    expectProgress(control, image.size());
+    parallelFor(image.size(), threads, [&](const size_t begin, const size_t end)
+                    {
+                        std::vector<Uint8> planeR(length), planeG(length), planeB(length);
+
+                        for (size_t x{begin}; x < end; ++x)
+                        {
+                            checkCancelled(control);
+
+                            const auto& source = image[x];
+                            auto& target = transformedImage[x];
+                            const size_t column = (x % Pattern::size) * period;
+
+                            if constexpr (Output::greyscale)
+                            {
+                                if (linearLight)
+                                {
+                                    for (size_t y{0}; y < length; ++y)
+                                    {
+                                        planeR[y] = positionsR[getLinearLuma(source[y], toLinear, toSrgb)];
+                                    }
+                                }
+                                else
+                                {
+                                    for (size_t y{0}; y < length; ++y)
+                                    {
+                                        planeR[y] = static_cast<Uint8>((77 * source[y].r + 150 * source[y].g + 29 * source[y].b + 128) >> 8);
+                                    }
+                                }
+
+                                quantizePlane<Output::levels[0], period>(planeR.data(), planeR.data(), length, thresholdsR.data() + column);
+
+                                for (size_t y{0}; y < length; ++y)
+                                {
+                                    target[y].r = planeR[y];
+                                    target[y].g = planeR[y];
+                                    target[y].b = planeR[y];
+                                }
+                            }
+                            else
+                            {
+                                for (size_t y{0}; y < length; ++y)
+                                {
+                                    planeR[y] = positionsR[source[y].r];
+                                    planeG[y] = positionsG[source[y].g];
+                                    planeB[y] = positionsB[source[y].b];
+                                }
+
+                                quantizePlane<Output::levels[0], period>(planeR.data(), planeR.data(), length, thresholdsR.data() + column);
+                                quantizePlane<Output::levels[1], period>(planeG.data(), planeG.data(), length, thresholdsG.data() + column);
+                                quantizePlane<Output::levels[2], period>(planeB.data(), planeB.data(), length, thresholdsB.data() + column);
+
+                                for (size_t y{0}; y < length; ++y)
+                                {
+                                    target[y].r = planeR[y];
+                                    target[y].g = planeG[y];
+                                    target[y].b = planeB[y];
+                                }
+                            }
+
+                            reportProgress(control);
+                        }
+                    });
+
+    return transformedImage;
+}
+
+template class OrderedDitherer<BayerPattern<2>, ColorOutput>;
+template class OrderedDitherer<BayerPattern<4>, ColorOutput>;
+template class OrderedDitherer<BayerPattern<8>, ColorOutput>;
+template class OrderedDitherer<BayerPattern<16>, ColorOutput>;
+template class OrderedDitherer<BayerPattern<2>, GreyscaleOutput<2>>;
+template class OrderedDitherer<BayerPattern<4>, GreyscaleOutput<2>>;
+template class OrderedDitherer<BayerPattern<8>, GreyscaleOutput<2>>;
+template class OrderedDitherer<BayerPattern<16>, GreyscaleOutput<2>>;
+template class OrderedDitherer<BayerPattern<2>, GreyscaleOutput<16>>;
+template class OrderedDitherer<BayerPattern<4>, GreyscaleOutput<16>>;
+template class OrderedDitherer<BayerPattern<8>, GreyscaleOutput<16>>;
+template class OrderedDitherer<BayerPattern<16>, GreyscaleOutput<16>>;
+template class OrderedDitherer<BlueNoisePattern, ColorOutput>;
+template class OrderedDitherer<BlueNoisePattern, GreyscaleOutput<16>>;
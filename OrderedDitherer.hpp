@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "BlueNoise.hpp"
+#include "TaskControl.hpp"
+
+template <size_t Size>
+constexpr std::array<std::array<Uint8, Size>, Size> bayerMatrix()
+{
+    static_assert(Size > 0 and Size <= 16 and (Size & (Size - 1)) == 0, "Bayer matrix size must be a power of two up to 16");
+
+    std::array<std::array<Uint8, Size>, Size> matrix{};
+    if constexpr (Size == 1)
+    {
+        matrix[0][0] = 0;
+    }
+    else
+    {
+        constexpr size_t half = Size / 2;
+        constexpr auto previous = bayerMatrix<half>();
+        constexpr std::array<std::array<int, 2>, 2> offsets{std::array<int, 2>{0, 2}, std::array<int, 2>{3, 1}};
+
+        for (size_t i{0}; i < Size; ++i)
+        {
+            for (size_t j{0}; j < Size; ++j)
+            {
+                matrix[i][j] = static_cast<Uint8>(4 * previous[i % half][j % half] + offsets[i / half][j / half]);
+            }
+        }
+    }
+    return matrix;
+}
+
+// Threshold patterns tiled over the image. Values are ranks in [0, ranks).
+template <size_t Size>
+struct BayerPattern
+{
+    static constexpr size_t size{Size};
+    static constexpr size_t ranks{Size * Size};
+    static constexpr auto values = bayerMatrix<Size>();
+};
+
+struct BlueNoisePattern
+{
+    static constexpr size_t size{blueNoiseSize};
+    static constexpr size_t ranks{256};
+    static constexpr const auto& values = blueNoiseTexture;
+};
+
+// Quantizes red, green and blue independently to the FourBitColor levels
+struct ColorOutput
+{
+    static constexpr bool greyscale{false};
+    static constexpr std::array<int, 3> levels{4, 2, 2};
+};
+
+// Quantizes luma to Levels evenly spaced greys
+template <int Levels>
+struct GreyscaleOutput
+{
+    static constexpr bool greyscale{true};
+    static constexpr std::array<int, 3> levels{Levels, Levels, Levels};
+};
+
+template <typename Pattern, typename Output>
+class OrderedDitherer
+{
+public:
+    // Lines are independent, so they are split across threads. In linear light the thresholds are compared with
+    // how far between two levels a color is in linear light rather than in sRGB bytes.
+    OrderedDitherer(const std::vector<std::vector<SDL_Color>>& image, unsigned threads, bool linearLight = false, TaskControl* control = nullptr);
+
+    std::vector<std::vector<SDL_Color>> perform() const;
+
+private:
+    const std::vector<std::vector<SDL_Color>>& image;
+    unsigned threads;
+    bool linearLight;
+    TaskControl* control;
+};
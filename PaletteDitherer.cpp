@@ -0,0 +1,147 @@
+#include "PaletteDitherer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "OrderedDitherer.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+template <size_t Size>
+std::vector<Uint8> flattenMatrix()
+{
+    constexpr auto matrix = bayerMatrix<Size>();
+
+    std::vector<Uint8> flattened;
+    flattened.reserve(Size * Size);
+    for (const auto& row : matrix)
+    {
+        flattened.insert(flattened.end(), row.begin(), row.end());
+    }
+    return flattened;
+}
+
+std::vector<Uint8> makeMatrix(const size_t matrixSize)
+{
+    switch (matrixSize)
+    {
+        case 2:
+            return flattenMatrix<2>();
+        case 4:
+            return flattenMatrix<4>();
+        case 8:
+            return flattenMatrix<8>();
+        case 16:
+            return flattenMatrix<16>();
+        default:
+            throw std::runtime_error("Unsupported dithering matrix size: " + std::to_string(matrixSize));
+    }
+}
+}
+
+PaletteDitherer::PaletteDitherer(const Palette& palette, const size_t matrixSize, const unsigned threads, const ColorMetric metric) : palette{palette},
+    matrixSize{matrixSize},
+    threads{threads},
+    matrix{makeMatrix(matrixSize)},
+    converter{metric},
+    search{palette.data(), palette.size(), converter}
+{
+    const size_t thresholdsCount = matrixSize * matrixSize;
+    const float spread = estimateSpread();
+    // Colors are looked up by their top bits, so each entry stands for the center of the bin of values sharing them
+    constexpr int binSize = 256 / channelLevels;
+
+    std::vector<int> offsets(thresholdsCount);
+    for (size_t t{0}; t < thresholdsCount; ++t)
+    {
+        offsets[t] = static_cast<int>(std::lround(((2.0f * t + 1.0f) / (2.0f * thresholdsCount) - 0.5f) * spread));
+    }
+
+    lookup.resize(channelLevels * channelLevels * channelLevels * thresholdsCount);
+
+    parallelFor(channelLevels * channelLevels * channelLevels, threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t color{begin}; color < end; ++color)
+                        {
+                            const int r = static_cast<int>(color >> (2 * channelBits)) * binSize + binSize / 2;
+                            const int g = static_cast<int>((color >> channelBits) & (channelLevels - 1)) * binSize + binSize / 2;
+                            const int b = static_cast<int>(color & (channelLevels - 1)) * binSize + binSize / 2;
+
+                            for (size_t t{0}; t < thresholdsCount; ++t)
+                            {
+                                lookup[color * thresholdsCount + t] = static_cast<Uint8>(findNeighbour(
+                                    std::clamp(r + offsets[t], 0, 255),
+                                    std::clamp(g + offsets[t], 0, 255),
+                                    std::clamp(b + offsets[t], 0, 255)));
+                            }
+                        }
+                    });
+}
+
+std::vector<std::vector<SDL_Color>> PaletteDitherer::perform(const std::vector<std::vector<SDL_Color>>& image, TaskControl* const control) const
+{
+    auto transformedImage = image;
+    const size_t thresholdsCount = matrixSize * matrixSize;
+    constexpr int shift = 8 - channelBits;
+
+    expectProgress(control, image.size());
+    parallelFor(image.size(), threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t x{begin}; x < end; ++x)
+                        {
+                            checkCancelled(control);
+
+                            const size_t column = x % matrixSize;
+                            for (size_t y{0}; y < image[x].size(); ++y)
+                            {
+                                const auto& [r, g, b, a] = image[x][y];
+                                const size_t color = (r >> shift) << (2 * channelBits) | (g >> shift) << channelBits | (b >> shift);
+                                const size_t threshold = matrix[(y % matrixSize) * matrixSize + column];
+                                transformedImage[x][y] = palette[lookup[color * thresholdsCount + threshold]];
+                            }
+
+                            reportProgress(control);
+                        }
+                    });
+
+    return transformedImage;
+}
+
+// Average distance from each palette entry to its closest distinct entry, i.e. how far apart the colors
+// the dither has to blend between typically are
+float PaletteDitherer::estimateSpread() const
+{
+    float sum{0.0f};
+    size_t count{0};
+
+    for (size_t i{0}; i < palette.size(); ++i)
+    {
+        int closest{std::numeric_limits<int>::max()};
+        for (size_t j{0}; j < palette.size(); ++j)
+        {
+            const int differenceR = palette[i].r - palette[j].r;
+            const int differenceG = palette[i].g - palette[j].g;
+            const int differenceB = palette[i].b - palette[j].b;
+
+            if (const int distance = differenceR * differenceR + differenceG * differenceG + differenceB * differenceB; distance > 0)
+            {
+                closest = std::min(closest, distance);
+            }
+        }
+
+        if (closest != std::numeric_limits<int>::max())
+        {
+            sum += std::sqrt(static_cast<float>(closest));
+            ++count;
+        }
+    }
+
+    return count == 0 ? 0.0f : sum / count;
+}
+
+size_t PaletteDitherer::findNeighbour(const int r, const int g, const int b) const
+{
+    return search.find(converter.convert(SDL_Color{static_cast<Uint8>(r), static_cast<Uint8>(g), static_cast<Uint8>(b), 1}));
+}
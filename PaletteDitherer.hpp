@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "ColorSpace.hpp"
+#include "IndexedFormat.hpp"
+#include "TaskControl.hpp"
+
+class PaletteDitherer
+{
+public:
+    // Precomputes the palette index for every (quantized color, matrix threshold) pair, nearest under the metric
+    PaletteDitherer(const Palette& palette, size_t matrixSize, unsigned threads, ColorMetric metric = ColorMetric::rgb);
+
+    std::vector<std::vector<SDL_Color>> perform(const std::vector<std::vector<SDL_Color>>& image, TaskControl* control = nullptr) const;
+
+private:
+    static constexpr int channelBits = 4;
+    static constexpr int channelLevels = 1 << channelBits;
+
+    const Palette& palette;
+    size_t matrixSize;
+    unsigned threads;
+    std::vector<Uint8> matrix;
+    std::vector<Uint8> lookup;
+    ColorConverter converter;
+    PaletteSearch search;
+
+    float estimateSpread() const;
+    size_t findNeighbour(int, int, int) const;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Splits [0, count) into one contiguous block per thread and calls function(begin, end) for each block.
+// threads == 0 selects std::thread::hardware_concurrency(). An exception thrown by a block is rethrown once every
+// block is done.
+template <typename Function>
+void parallelFor(const size_t count, unsigned threads, Function&& function)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    const size_t workers = std::min<size_t>(threads, count);
+    if (workers <= 1)
+    {
+        if (count > 0)
+        {
+            function(size_t{0}, count);
+        }
+        return;
+    }
+
+    const size_t block = (count + workers - 1) / workers;
+
+    std::vector<std::exception_ptr> errors(workers);
+    const auto run = [&function, &errors, block, count](const size_t begin)
+    {
+        try
+        {
+            function(begin, std::min(count, begin + block));
+        }
+        catch (...)
+        {
+            errors[begin / block] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(workers - 1);
+    for (size_t begin{block}; begin < count; begin += block)
+    {
+        pool.emplace_back(run, begin);
+    }
+    run(0);
+
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+
+    for (const auto& error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// Runs both functions, the first one on a new thread when fork is set, and returns once both are done
+template <typename First, typename Second>
+void parallelInvoke(const bool fork, First&& first, Second&& second)
+{
+    if (not fork)
+    {
+        first();
+        second();
+        return;
+    }
+
+    std::exception_ptr error;
+    std::thread thread{[&first, &error]
+                           {
+                               try
+                               {
+                                   first();
+                               }
+                               catch (...)
+                               {
+                                   error = std::current_exception();
+                               }
+                           }};
+
+    try
+    {
+        second();
+    }
+    catch (...)
+    {
+        thread.join();
+        throw;
+    }
+
+    thread.join();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,296 @@
+#include "QualityMetrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "ColorSpace.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+constexpr size_t windowSize{11};
+constexpr size_t windowRadius{windowSize / 2};
+constexpr double windowSigma{1.5};
+constexpr size_t stripLines{64};
+
+// SSIM stabilizing constants for 8 bit channels
+constexpr float c1 = (0.01f * 255.0f) * (0.01f * 255.0f);
+constexpr float c2 = (0.03f * 255.0f) * (0.03f * 255.0f);
+
+// Luma and the products of luma the window averages for SSIM
+enum Plane
+{
+    originalLuma,
+    transformedLuma,
+    originalSquares,
+    transformedSquares,
+    crossProducts,
+    planesCount,
+};
+
+struct StripSums
+{
+    std::array<double, 3> squaredErrors{};
+    double structuralSimilarity{0.0};
+    double deltaE{0.0};
+    double maxDeltaE{0.0};
+};
+
+// Conversions to CIELAB of the colors seen last, direct mapped by a hash of the color. Transformed images have few
+// colors and photographs repeat theirs in smooth areas, so most pixels skip the conversion.
+class LabCache
+{
+public:
+    explicit LabCache(const ColorConverter& converter) : converter{converter}
+    {
+        keys.fill(empty);
+    }
+
+    const MetricColor& convert(const SDL_Color& color)
+    {
+        const Uint32 key = static_cast<Uint32>(color.r) << 16 | static_cast<Uint32>(color.g) << 8 | color.b;
+        const size_t slot = static_cast<Uint32>(key * 2654435761u) >> (32 - slotBits);
+        if (keys[slot] != key)
+        {
+            keys[slot] = key;
+            values[slot] = converter.convert(color);
+        }
+        return values[slot];
+    }
+
+private:
+    static constexpr unsigned slotBits{12};
+    static constexpr Uint32 empty{0xFFFFFFFF};
+
+    const ColorConverter& converter;
+    std::array<Uint32, size_t{1} << slotBits> keys;
+    std::array<MetricColor, size_t{1} << slotBits> values;
+};
+
+const std::array<float, windowSize>& getGaussianWindow()
+{
+    static const auto window = []
+    {
+        std::array<float, windowSize> weights{};
+        double sum{0.0};
+        for (size_t i{0}; i < windowSize; ++i)
+        {
+            const double distance = static_cast<double>(i) - static_cast<double>(windowRadius);
+            sum += std::exp(-distance * distance / (2.0 * windowSigma * windowSigma));
+        }
+        for (size_t i{0}; i < windowSize; ++i)
+        {
+            const double distance = static_cast<double>(i) - static_cast<double>(windowRadius);
+            weights[i] = static_cast<float>(std::exp(-distance * distance / (2.0 * windowSigma * windowSigma)) / sum);
+        }
+        return weights;
+    }();
+    return window;
+}
+
+// output[i] is the window weighted sum of inputs[k][i]. Along a line the inputs are one padded line shifted by k,
+// across lines they are the lines of the window.
+void applyWindow(const std::array<const float*, windowSize>& inputs, float* output, const size_t count)
+{
+    const auto& weights = getGaussianWindow();
+    size_t i{0};
+
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (size_t k{0}; k < windowSize; ++k)
+        {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(inputs[k] + i)));
+        }
+        _mm_storeu_ps(output + i, sum);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        float sum{0.0f};
+        for (size_t k{0}; k < windowSize; ++k)
+        {
+            sum += weights[k] * inputs[k][i];
+        }
+        output[i] = sum;
+    }
+}
+
+float getLuma(const SDL_Color& color)
+{
+    return 0.299f * color.r + 0.587f * color.g + 0.114f * color.b;
+}
+
+double getPeakSignalToNoiseRatio(const double meanSquaredError)
+{
+    return meanSquaredError == 0.0 ? std::numeric_limits<double>::infinity() : 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
+
+// Lines [begin, end). The window reaches windowRadius lines past both ends, whose planes are averaged along the lines
+// first and then across them.
+StripSums measureStrip(const std::vector<std::vector<SDL_Color>>& original, const std::vector<std::vector<SDL_Color>>& transformed,
+                       const ColorConverter& converter, const size_t begin, const size_t end)
+{
+    StripSums sums;
+    LabCache labCache{converter};
+    const size_t lines = original.size();
+    const size_t length = original[0].size();
+
+    for (size_t x{begin}; x < end; ++x)
+    {
+        for (size_t y{0}; y < length; ++y)
+        {
+            const SDL_Color& originalColor = original[x][y];
+            const SDL_Color& transformedColor = transformed[x][y];
+
+            const int differenceR = originalColor.r - transformedColor.r;
+            const int differenceG = originalColor.g - transformedColor.g;
+            const int differenceB = originalColor.b - transformedColor.b;
+            sums.squaredErrors[0] += differenceR * differenceR;
+            sums.squaredErrors[1] += differenceG * differenceG;
+            sums.squaredErrors[2] += differenceB * differenceB;
+
+            // CIELAB comes in 1/16 units
+            const MetricColor originalLab = labCache.convert(originalColor);
+            const MetricColor transformedLab = labCache.convert(transformedColor);
+            double squaredDistance{0.0};
+            for (size_t channel{0}; channel < 3; ++channel)
+            {
+                const double difference = originalLab[channel] - transformedLab[channel];
+                squaredDistance += difference * difference;
+            }
+            const double deltaE = std::sqrt(squaredDistance) / 16.0;
+            sums.deltaE += deltaE;
+            sums.maxDeltaE = std::max(sums.maxDeltaE, deltaE);
+        }
+    }
+
+    const size_t windowLines = end - begin + 2 * windowRadius;
+    std::vector<float> padded(planesCount * (length + 2 * windowRadius));
+    std::vector<float> alongLines(planesCount * windowLines * length);
+    const auto paddedPlane = [&padded, length](const size_t plane)
+    {
+        return padded.data() + plane * (length + 2 * windowRadius);
+    };
+    const auto alongLinesPlane = [&alongLines, windowLines, length](const size_t plane, const size_t line)
+    {
+        return alongLines.data() + (plane * windowLines + line) * length;
+    };
+
+    for (size_t line{0}; line < windowLines; ++line)
+    {
+        const size_t x = static_cast<size_t>(std::clamp<ptrdiff_t>(static_cast<ptrdiff_t>(begin + line) - static_cast<ptrdiff_t>(windowRadius), 0,
+                                                                   static_cast<ptrdiff_t>(lines) - 1));
+        for (size_t y{0}; y < length + 2 * windowRadius; ++y)
+        {
+            const size_t position = std::min(std::max(y, windowRadius) - windowRadius, length - 1);
+            const float originalValue = getLuma(original[x][position]);
+            const float transformedValue = getLuma(transformed[x][position]);
+
+            paddedPlane(originalLuma)[y] = originalValue;
+            paddedPlane(transformedLuma)[y] = transformedValue;
+            paddedPlane(originalSquares)[y] = originalValue * originalValue;
+            paddedPlane(transformedSquares)[y] = transformedValue * transformedValue;
+            paddedPlane(crossProducts)[y] = originalValue * transformedValue;
+        }
+
+        for (size_t plane{0}; plane < planesCount; ++plane)
+        {
+            std::array<const float*, windowSize> inputs;
+            for (size_t k{0}; k < windowSize; ++k)
+            {
+                inputs[k] = paddedPlane(plane) + k;
+            }
+            applyWindow(inputs, alongLinesPlane(plane, line), length);
+        }
+    }
+
+    std::vector<float> averages(planesCount * length);
+    for (size_t x{begin}; x < end; ++x)
+    {
+        for (size_t plane{0}; plane < planesCount; ++plane)
+        {
+            std::array<const float*, windowSize> inputs;
+            for (size_t k{0}; k < windowSize; ++k)
+            {
+                inputs[k] = alongLinesPlane(plane, x - begin + k);
+            }
+            applyWindow(inputs, averages.data() + plane * length, length);
+        }
+
+        for (size_t y{0}; y < length; ++y)
+        {
+            const float meanOriginal = averages[originalLuma * length + y];
+            const float meanTransformed = averages[transformedLuma * length + y];
+            const float varianceOriginal = averages[originalSquares * length + y] - meanOriginal * meanOriginal;
+            const float varianceTransformed = averages[transformedSquares * length + y] - meanTransformed * meanTransformed;
+            const float covariance = averages[crossProducts * length + y] - meanOriginal * meanTransformed;
+
+            sums.structuralSimilarity += (2.0f * meanOriginal * meanTransformed + c1) * (2.0f * covariance + c2) /
+                                         ((meanOriginal * meanOriginal + meanTransformed * meanTransformed + c1) * (varianceOriginal + varianceTransformed + c2));
+        }
+    }
+
+    return sums;
+}
+}
+
+QualityMetrics measureQuality(const std::vector<std::vector<SDL_Color>>& original, const std::vector<std::vector<SDL_Color>>& transformed, const unsigned threads)
+{
+    if (original.size() != transformed.size() or original.empty() or original[0].empty())
+    {
+        throw std::runtime_error("Images to measure must have the same, non zero size");
+    }
+    for (size_t x{0}; x < original.size(); ++x)
+    {
+        if (original[x].size() != original[0].size() or transformed[x].size() != original[0].size())
+        {
+            throw std::runtime_error("Images to measure must have the same, non zero size");
+        }
+    }
+
+    const ColorConverter converter{ColorMetric::cielab};
+    const size_t strips = (original.size() + stripLines - 1) / stripLines;
+    std::vector<StripSums> stripSums(strips);
+
+    parallelFor(strips, threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t strip{begin}; strip < end; ++strip)
+                        {
+                            stripSums[strip] = measureStrip(original, transformed, converter, strip * stripLines, std::min(original.size(), (strip + 1) * stripLines));
+                        }
+                    });
+
+    // Strips are added up in order, so the result does not depend on the threads
+    StripSums total;
+    for (const auto& sums : stripSums)
+    {
+        for (size_t channel{0}; channel < 3; ++channel)
+        {
+            total.squaredErrors[channel] += sums.squaredErrors[channel];
+        }
+        total.structuralSimilarity += sums.structuralSimilarity;
+        total.deltaE += sums.deltaE;
+        total.maxDeltaE = std::max(total.maxDeltaE, sums.maxDeltaE);
+    }
+
+    const double pixels = static_cast<double>(original.size() * original[0].size());
+    QualityMetrics metrics;
+    for (size_t channel{0}; channel < 3; ++channel)
+    {
+        metrics.meanSquaredError[channel] = total.squaredErrors[channel] / pixels;
+        metrics.peakSignalToNoiseRatio[channel] = getPeakSignalToNoiseRatio(metrics.meanSquaredError[channel]);
+    }
+    metrics.totalMeanSquaredError = (total.squaredErrors[0] + total.squaredErrors[1] + total.squaredErrors[2]) / (3.0 * pixels);
+    metrics.totalPeakSignalToNoiseRatio = getPeakSignalToNoiseRatio(metrics.totalMeanSquaredError);
+    metrics.structuralSimilarity = total.structuralSimilarity / pixels;
+    metrics.meanDeltaE = total.deltaE / pixels;
+    metrics.maxDeltaE = total.maxDeltaE;
+
+    return metrics;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <SDL2/SDL.h>
+
+// How close a transformed image is to the original. PSNR is infinite for identical images.
+struct QualityMetrics
+{
+    // Red, green and blue
+    std::array<double, 3> meanSquaredError{};
+    std::array<double, 3> peakSignalToNoiseRatio{};
+    // Over the three channels together
+    double totalMeanSquaredError{0.0};
+    double totalPeakSignalToNoiseRatio{0.0};
+    // Mean SSIM of luma under an 11 by 11 Gaussian window of sigma 1.5, with the edge pixels repeated past the edges
+    double structuralSimilarity{0.0};
+    // CIE76 differences in CIELAB
+    double meanDeltaE{0.0};
+    double maxDeltaE{0.0};
+};
+
+// Images of the same size are measured in strips of lines, in parallel. The SSIM window is separable and both of its
+// passes sum four positions per SSE instruction. threads == 0 selects std::thread::hardware_concurrency().
+QualityMetrics measureQuality(const std::vector<std::vector<SDL_Color>>& original, const std::vector<std::vector<SDL_Color>>& transformed, unsigned threads = 0);
@@ -0,0 +1,195 @@
+#include "ResultCache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include "ImageFile.hpp"
+
+namespace
+{
+void writeValue(std::ostream& stream, const uint64_t value)
+{
+    char bytes[8];
+    for (size_t i{0}; i < sizeof(bytes); ++i)
+    {
+        bytes[i] = static_cast<char>(value >> 8 * i);
+    }
+    stream.write(bytes, sizeof(bytes));
+}
+
+uint64_t readValue(std::istream& stream)
+{
+    Uint8 bytes[8];
+    if (not stream.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+    {
+        throw std::runtime_error("Truncated cache entry");
+    }
+
+    uint64_t value{0};
+    for (size_t i{0}; i < sizeof(bytes); ++i)
+    {
+        value |= static_cast<uint64_t>(bytes[i]) << 8 * i;
+    }
+    return value;
+}
+
+void writeSampling(std::ostream& stream, const PaletteSampling& sampling)
+{
+    uint64_t errorBound;
+    std::memcpy(&errorBound, &sampling.errorBound, sizeof(errorBound));
+
+    writeValue(stream, sampling.sampledPixels);
+    writeValue(stream, sampling.totalPixels);
+    writeValue(stream, errorBound);
+}
+
+PaletteSampling readSampling(std::istream& stream)
+{
+    PaletteSampling sampling;
+    sampling.sampledPixels = readValue(stream);
+    sampling.totalPixels = readValue(stream);
+
+    const uint64_t errorBound = readValue(stream);
+    std::memcpy(&sampling.errorBound, &errorBound, sizeof(errorBound));
+    return sampling;
+}
+}
+
+ResultCache::ResultCache(std::filesystem::path directory, const uintmax_t maxBytes) : directory{std::move(directory)},
+    maxBytes{maxBytes},
+    enabled{false}
+{
+    std::error_code error;
+    std::filesystem::create_directories(this->directory, error);
+    enabled = not error;
+}
+
+std::optional<ResultCache::Entry> ResultCache::find(const uint64_t key, const size_t lines, const size_t length)
+{
+    if (not enabled)
+    {
+        return std::nullopt;
+    }
+
+    const std::lock_guard<std::mutex> lock{mutex};
+    const auto path = getPath(key);
+
+    std::ifstream file(path, std::ios::binary);
+    if (not file)
+    {
+        return std::nullopt;
+    }
+
+    // A damaged entry is a miss, the result is computed and stored again
+    try
+    {
+        const PaletteSampling sampling = readSampling(file);
+        Entry entry{readImageFile(file), sampling};
+        if (entry.image.lines != lines or entry.image.length != length)
+        {
+            return std::nullopt;
+        }
+
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        return entry;
+    }
+    catch (const std::exception&)
+    {
+        return std::nullopt;
+    }
+}
+
+void ResultCache::store(const uint64_t key, const IndexedImage<defaultBits>& image, const PaletteSampling& sampling)
+{
+    if (not enabled)
+    {
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock{mutex};
+    const auto path = getPath(key);
+
+    // Written under a temporary name first, so a reader never sees half of an entry. A result that cannot be stored
+    // is only computed again next time, it does not fail the transformation.
+    auto temporary = path;
+    temporary += ".tmp";
+    std::error_code error;
+
+    try
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (not file)
+        {
+            return;
+        }
+
+        writeSampling(file, sampling);
+        writeImageFile(file, image);
+        file.close();
+        if (not file)
+        {
+            throw std::runtime_error("Failed to write cache entry");
+        }
+    }
+    catch (const std::exception&)
+    {
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+    }
+
+    evict();
+}
+
+std::filesystem::path ResultCache::getPath(const uint64_t key) const
+{
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return directory / (std::string{name} + ".gkimg");
+}
+
+void ResultCache::evict()
+{
+    struct Entry
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uintmax_t size;
+    };
+
+    std::vector<Entry> entries;
+    uintmax_t total{0};
+    std::error_code error;
+
+    for (const auto& file : std::filesystem::directory_iterator{directory, error})
+    {
+        // Temporary files left behind by a store that was interrupted count too
+        if (file.path().extension() != ".gkimg" and file.path().extension() != ".tmp")
+        {
+            continue;
+        }
+        entries.push_back(Entry{file.path(), file.last_write_time(error), file.file_size(error)});
+        total += entries.back().size;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+                  {
+                      return lhs.time < rhs.time;
+                  });
+
+    for (auto entry = entries.begin(); total > maxBytes and entry != entries.end(); ++entry)
+    {
+        if (std::filesystem::remove(entry->path, error))
+        {
+            total -= entry->size;
+        }
+    }
+}
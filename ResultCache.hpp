@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include "IndexedFormat.hpp"
+#include "MedianCutter.hpp"
+
+// Transformation results kept on disk, each the sampling of its palette followed by a .gkimg file, named by a key that
+// covers the input pixels, the transformation and its parameters. Reading a result refreshes its modification time, and storing one removes the
+// least recently used files until the directory is back under maxBytes.
+class ResultCache
+{
+public:
+    struct Entry
+    {
+        IndexedImage<defaultBits> image;
+        PaletteSampling sampling;
+    };
+
+    // The cache turns itself off when the directory cannot be created, then nothing is found or stored
+    ResultCache(std::filesystem::path directory, uintmax_t maxBytes);
+
+    // An entry whose image is not lines by length is a miss
+    std::optional<Entry> find(uint64_t key, size_t lines, size_t length);
+    // A result that cannot be written is left out, storing never fails
+    void store(uint64_t key, const IndexedImage<defaultBits>&, const PaletteSampling&);
+
+private:
+    std::filesystem::path directory;
+    uintmax_t maxBytes;
+    bool enabled;
+    std::mutex mutex;
+
+    std::filesystem::path getPath(uint64_t) const;
+    void evict();
+};
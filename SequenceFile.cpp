@@ -0,0 +1,315 @@
+#include "SequenceFile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include "Compression.hpp"
+#include "Parallel.hpp"
+
+namespace
+{
+using Format = IndexedFormat<defaultBits>;
+
+constexpr char magic[4]{'G', 'K', 'S', 'Q'};
+constexpr Uint8 version{1};
+constexpr size_t tileSize{16};
+constexpr size_t headerSize{sizeof(magic) + 2 + 4 * 4 + Format::paletteSize * 3};
+constexpr size_t entrySize{1 + 4 + 4 + 8};
+
+// Tiles start on a byte boundary of the packed lines, so they are copied as bytes
+struct TileGrid
+{
+    size_t lines;
+    size_t lineSize;
+    size_t tileBytes;
+    size_t rows;
+    size_t columns;
+
+    TileGrid(const size_t lines, const size_t length) : lines{lines},
+        lineSize{Format::packedSize(length)},
+        tileBytes{Format::packedSize(tileSize)},
+        rows{(lines + tileSize - 1) / tileSize},
+        columns{(lineSize + tileBytes - 1) / tileBytes}
+    {}
+
+    size_t getCount() const
+    {
+        return rows * columns;
+    }
+
+    // Lines and bytes of the tile within the packed plane
+    void getBounds(const size_t tile, size_t& firstLine, size_t& lastLine, size_t& first, size_t& last) const
+    {
+        firstLine = tile / columns * tileSize;
+        lastLine = std::min(firstLine + tileSize, lines);
+        first = tile % columns * tileBytes;
+        last = std::min(first + tileBytes, lineSize);
+    }
+};
+
+void writeValue(std::ostream& stream, const Uint32 value)
+{
+    const char bytes[4]{static_cast<char>(value), static_cast<char>(value >> 8), static_cast<char>(value >> 16), static_cast<char>(value >> 24)};
+    stream.write(bytes, sizeof(bytes));
+}
+
+void readBytes(std::istream& stream, void* target, const size_t size)
+{
+    if (not stream.read(static_cast<char*>(target), static_cast<std::streamsize>(size)))
+    {
+        throw std::runtime_error("Truncated .gkseq file");
+    }
+}
+
+Uint32 readValue(std::istream& stream)
+{
+    Uint8 bytes[4];
+    readBytes(stream, bytes, sizeof(bytes));
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<Uint32>(bytes[3]) << 24;
+}
+
+bool isTileChanged(const std::vector<Uint8>& current, const std::vector<Uint8>& previous, const TileGrid& grid, const size_t tile)
+{
+    size_t firstLine, lastLine, first, last;
+    grid.getBounds(tile, firstLine, lastLine, first, last);
+
+    for (size_t line{firstLine}; line < lastLine; ++line)
+    {
+        const size_t offset = line * grid.lineSize;
+        if (not std::equal(current.begin() + offset + first, current.begin() + offset + last, previous.begin() + offset + first))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A bitmap of the changed tiles followed by the bytes of each changed tile, line by line
+std::vector<Uint8> makeDelta(const std::vector<Uint8>& current, const std::vector<Uint8>& previous, const TileGrid& grid)
+{
+    std::vector<Uint8> delta((grid.getCount() + 7) / 8, 0);
+
+    for (size_t tile{0}; tile < grid.getCount(); ++tile)
+    {
+        if (not isTileChanged(current, previous, grid, tile))
+        {
+            continue;
+        }
+
+        delta[tile / 8] |= static_cast<Uint8>(1 << tile % 8);
+
+        size_t firstLine, lastLine, first, last;
+        grid.getBounds(tile, firstLine, lastLine, first, last);
+        for (size_t line{firstLine}; line < lastLine; ++line)
+        {
+            const auto source = current.begin() + line * grid.lineSize;
+            delta.insert(delta.end(), source + first, source + last);
+        }
+    }
+
+    return delta;
+}
+}
+
+void writeSequenceFile(std::ostream& stream, const std::vector<IndexedImage<defaultBits>>& frames, const size_t keyframeInterval, const unsigned threads)
+{
+    if (frames.empty() or keyframeInterval == 0)
+    {
+        throw std::runtime_error("A sequence needs frames and a keyframe interval");
+    }
+
+    const auto& first = frames[0];
+    for (const auto& frame : frames)
+    {
+        const bool samePalette = std::equal(frame.palette.begin(), frame.palette.end(), first.palette.begin(), [](const SDL_Color& lhs, const SDL_Color& rhs)
+                                                {
+                                                    return lhs.r == rhs.r and lhs.g == rhs.g and lhs.b == rhs.b;
+                                                });
+        if (frame.lines != first.lines or frame.length != first.length or not samePalette)
+        {
+            throw std::runtime_error("Frames of a sequence must share their size and palette");
+        }
+    }
+
+    const TileGrid grid{first.lines, first.length};
+
+    // Deltas only depend on the frame before, which is known up front, so every frame is encoded on its own
+    std::vector<Chunk> chunks(frames.size());
+    std::vector<size_t> decodedSizes(frames.size());
+    parallelFor(frames.size(), threads, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t f{begin}; f < end; ++f)
+                        {
+                            const auto& indices = frames[f].indices;
+                            if (f % keyframeInterval == 0)
+                            {
+                                decodedSizes[f] = indices.size();
+                                chunks[f] = compressChunk(indices.data(), indices.size());
+                            }
+                            else
+                            {
+                                const auto delta = makeDelta(indices, frames[f - 1].indices, grid);
+                                decodedSizes[f] = delta.size();
+                                chunks[f] = compressChunk(delta.data(), delta.size());
+                            }
+                        }
+                    });
+
+    stream.write(magic, sizeof(magic));
+    stream.put(static_cast<char>(version));
+    stream.put(static_cast<char>(Format::bits));
+    writeValue(stream, static_cast<Uint32>(first.lines));
+    writeValue(stream, static_cast<Uint32>(first.length));
+    writeValue(stream, static_cast<Uint32>(frames.size()));
+    writeValue(stream, static_cast<Uint32>(keyframeInterval));
+
+    for (const auto& color : first.palette)
+    {
+        stream.put(static_cast<char>(color.r));
+        stream.put(static_cast<char>(color.g));
+        stream.put(static_cast<char>(color.b));
+    }
+
+    uint64_t offset{headerSize + frames.size() * entrySize};
+    for (size_t f{0}; f < frames.size(); ++f)
+    {
+        stream.put(static_cast<char>(chunks[f].codec));
+        writeValue(stream, static_cast<Uint32>(chunks[f].data.size()));
+        writeValue(stream, static_cast<Uint32>(decodedSizes[f]));
+        writeValue(stream, static_cast<Uint32>(offset));
+        writeValue(stream, static_cast<Uint32>(offset >> 32));
+        offset += chunks[f].data.size();
+    }
+
+    for (const auto& chunk : chunks)
+    {
+        stream.write(reinterpret_cast<const char*>(chunk.data.data()), static_cast<std::streamsize>(chunk.data.size()));
+    }
+
+    if (not stream)
+    {
+        throw std::runtime_error("Failed to write .gkseq file");
+    }
+}
+
+SequenceReader::SequenceReader(std::istream& stream) : stream{stream},
+    start{stream.tellg()},
+    keyframeInterval{0},
+    frame{},
+    current{0}
+{
+    char fileMagic[4];
+    Uint8 fileVersion, fileBits;
+    readBytes(stream, fileMagic, sizeof(fileMagic));
+    readBytes(stream, &fileVersion, 1);
+    readBytes(stream, &fileBits, 1);
+
+    if (not std::equal(std::begin(magic), std::end(magic), fileMagic) or fileVersion != version or fileBits != Format::bits)
+    {
+        throw std::runtime_error("Unsupported .gkseq file");
+    }
+
+    frame.lines = readValue(stream);
+    frame.length = readValue(stream);
+    entries.resize(readValue(stream));
+    keyframeInterval = readValue(stream);
+
+    if (keyframeInterval == 0)
+    {
+        throw std::runtime_error("Corrupt .gkseq header");
+    }
+
+    for (auto& color : frame.palette)
+    {
+        Uint8 rgb[3];
+        readBytes(stream, rgb, sizeof(rgb));
+        color = SDL_Color{rgb[0], rgb[1], rgb[2], 1};
+    }
+
+    for (auto& entry : entries)
+    {
+        readBytes(stream, &entry.codec, 1);
+        entry.size = readValue(stream);
+        entry.decodedSize = readValue(stream);
+        entry.offset = readValue(stream);
+        entry.offset |= static_cast<uint64_t>(readValue(stream)) << 32;
+    }
+
+    frame.indices.resize(frame.lines * Format::packedSize(frame.length));
+    current = entries.size();
+}
+
+size_t SequenceReader::getFramesCount() const
+{
+    return entries.size();
+}
+
+const IndexedImage<defaultBits>& SequenceReader::readFrame(const size_t index)
+{
+    if (index >= entries.size())
+    {
+        throw std::runtime_error("Frame outside of the .gkseq sequence");
+    }
+
+    const size_t keyframe = index - index % keyframeInterval;
+    size_t next = current < entries.size() and current >= keyframe and current <= index ? current + 1 : keyframe;
+
+    for (; next <= index; ++next)
+    {
+        // A frame that fails to decode leaves a partly updated one, which no later read may build on
+        current = entries.size();
+        applyFrame(next);
+        current = next;
+    }
+
+    return frame;
+}
+
+void SequenceReader::applyFrame(const size_t index)
+{
+    const FrameEntry& entry = entries[index];
+    Chunk chunk{static_cast<Codec>(entry.codec), std::vector<Uint8>(entry.size)};
+
+    if (not stream.seekg(start + static_cast<std::streamoff>(entry.offset)))
+    {
+        throw std::runtime_error("Corrupt .gkseq frame offset");
+    }
+    readBytes(stream, chunk.data.data(), entry.size);
+
+    if (index % keyframeInterval == 0)
+    {
+        frame.indices = decompressChunk(chunk, frame.indices.size());
+        return;
+    }
+
+    const auto delta = decompressChunk(chunk, entry.decodedSize);
+    const TileGrid grid{frame.lines, frame.length};
+    size_t position = (grid.getCount() + 7) / 8;
+
+    if (delta.size() < position)
+    {
+        throw std::runtime_error("Corrupt .gkseq delta");
+    }
+
+    for (size_t tile{0}; tile < grid.getCount(); ++tile)
+    {
+        if (not (delta[tile / 8] >> tile % 8 & 1))
+        {
+            continue;
+        }
+
+        size_t firstLine, lastLine, first, last;
+        grid.getBounds(tile, firstLine, lastLine, first, last);
+        if (delta.size() - position < (lastLine - firstLine) * (last - first))
+        {
+            throw std::runtime_error("Corrupt .gkseq delta");
+        }
+
+        for (size_t line{firstLine}; line < lastLine; ++line)
+        {
+            std::copy(delta.begin() + position, delta.begin() + position + (last - first), frame.indices.begin() + line * grid.lineSize + first);
+            position += last - first;
+        }
+    }
+}
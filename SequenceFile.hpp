@@ -0,0 +1,42 @@
+#pragma once
+
+#include <iosfwd>
+#include <vector>
+#include "IndexedFormat.hpp"
+
+// .gkseq files hold frames of one size and palette. Every keyframeInterval-th frame is stored whole, the frames in
+// between only as the 16x16 tiles of packed indices that differ from the frame before. A table of frame offsets
+// follows the palette, so readers can seek to the keyframe before any frame. threads == 0 selects
+// std::thread::hardware_concurrency().
+void writeSequenceFile(std::ostream&, const std::vector<IndexedImage<defaultBits>>& frames, size_t keyframeInterval = 30, unsigned threads = 0);
+
+// Keeps the last frame read and applies deltas to it in place, so reading frames in order decodes only the tiles
+// that change
+class SequenceReader
+{
+public:
+    explicit SequenceReader(std::istream&);
+
+    size_t getFramesCount() const;
+    // Decodes from the current frame when it comes before the requested one, from the closest keyframe otherwise
+    const IndexedImage<defaultBits>& readFrame(size_t);
+
+private:
+    struct FrameEntry
+    {
+        Uint8 codec;
+        Uint32 size;
+        Uint32 decodedSize;
+        uint64_t offset;
+    };
+
+    std::istream& stream;
+    std::streampos start;
+    size_t keyframeInterval;
+    std::vector<FrameEntry> entries;
+    IndexedImage<defaultBits> frame;
+    // Index of the frame held, entries.size() before the first read
+    size_t current;
+
+    void applyFrame(size_t);
+};
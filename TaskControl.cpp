@@ -0,0 +1,53 @@
+#include "TaskControl.hpp"
+#include <algorithm>
+
+void TaskControl::cancel()
+{
+    cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool TaskControl::isCancelled() const
+{
+    return cancelled.load(std::memory_order_relaxed);
+}
+
+void TaskControl::expect(const size_t lines)
+{
+    expected.fetch_add(lines, std::memory_order_relaxed);
+}
+
+void TaskControl::advance(const size_t lines)
+{
+    done.fetch_add(lines, std::memory_order_relaxed);
+}
+
+double TaskControl::getProgress() const
+{
+    const size_t expectedLines = expected.load(std::memory_order_relaxed);
+    const size_t doneLines = done.load(std::memory_order_relaxed);
+    return expectedLines == 0 ? 0.0 : static_cast<double>(std::min(doneLines, expectedLines)) / static_cast<double>(expectedLines);
+}
+
+void checkCancelled(const TaskControl* control)
+{
+    if (control and control->isCancelled())
+    {
+        throw TaskCancelled{};
+    }
+}
+
+void expectProgress(TaskControl* control, const size_t lines)
+{
+    if (control)
+    {
+        control->expect(lines);
+    }
+}
+
+void reportProgress(TaskControl* control, const size_t lines)
+{
+    if (control)
+    {
+        control->advance(lines);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+
+class TaskCancelled final : public std::exception
+{
+public:
+    char const* what() const noexcept(true) override
+    {
+        return "Task cancelled";
+    }
+};
+
+// Shared by a long running task and the thread that started it. The task polls for cancellation once per line or
+// bucket and counts the lines it has finished, the starting thread cancels it and reads the progress.
+class TaskControl
+{
+public:
+    void cancel();
+    bool isCancelled() const;
+
+    // Passes of a task over the image expect their lines as they start, so the progress steps back when one begins
+    void expect(size_t lines);
+    void advance(size_t lines);
+    // Finished lines over the expected ones, in [0, 1]
+    double getProgress() const;
+
+private:
+    std::atomic<bool> cancelled{false};
+    std::atomic<size_t> expected{0};
+    std::atomic<size_t> done{0};
+};
+
+// The helpers below do nothing without a control, which is how tasks run outside of the worker
+
+// Throws TaskCancelled once the task was cancelled
+void checkCancelled(const TaskControl*);
+void expectProgress(TaskControl*, size_t lines);
+void reportProgress(TaskControl*, size_t lines = 1);
@@ -0,0 +1,68 @@
+#include "TransformComparison.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "Parallel.hpp"
+
+TransformComparison::TransformComparison(const TransformOptions& options) : options{options}
+{
+    this->options.cache = nullptr;
+}
+
+std::vector<TransformComparison::Result> TransformComparison::perform(const Image& image, const std::vector<Image::Transformation>& transformations,
+                                                                      const std::function<void(size_t, const Result&)>& onResult) const
+{
+    std::vector<Result> results(transformations.size());
+
+    const unsigned threads = options.threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : options.threads;
+    const unsigned workers = static_cast<unsigned>(std::min<size_t>(threads, transformations.size()));
+    if (workers == 0)
+    {
+        return results;
+    }
+
+    TransformOptions workerOptions = options;
+    workerOptions.threads = std::max(1u, threads / workers);
+
+    std::atomic<size_t> next{0};
+    parallelFor(workers, workers, [&](size_t, size_t)
+                    {
+                        for (size_t i = next++; i < transformations.size(); i = next++)
+                        {
+                            checkCancelled(options.control);
+
+                            Result& result = results[i];
+                            result.transformation = transformations[i];
+
+                            const auto start = std::chrono::steady_clock::now();
+                            try
+                            {
+                                Image transformed = image;
+                                transformed.transform(transformations[i], workerOptions);
+                                result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                                if (transformed.isTransformed())
+                                {
+                                    result.quality = measureQuality(transformed.getOriginalBmp(), transformed.getTransformedBmp().value(), workerOptions.threads);
+                                    result.image = transformed.getIndexed();
+                                }
+                            }
+                            catch (const TaskCancelled&)
+                            {
+                                throw;
+                            }
+                            catch (const std::exception& e)
+                            {
+                                result.error = e.what();
+                            }
+
+                            if (onResult)
+                            {
+                                onResult(i, result);
+                            }
+                        }
+                    });
+
+    return results;
+}
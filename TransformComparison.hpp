@@ -0,0 +1,36 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+#include "Image.hpp"
+#include "IndexedFormat.hpp"
+#include "QualityMetrics.hpp"
+#include "TransformOptions.hpp"
+
+// Transforms copies of one image with several transformations at once and measures every result against the original.
+// Workers take the next transformation as soon as they finish one, and the threads of the options are shared among
+// them, so a transformation that runs alone uses all of them.
+class TransformComparison
+{
+public:
+    struct Result
+    {
+        Image::Transformation transformation{Image::Transformation::none};
+        // Empty when the transformation failed
+        std::optional<IndexedImage<defaultBits>> image;
+        std::string error;
+        double milliseconds{0.0};
+        QualityMetrics quality;
+    };
+
+    explicit TransformComparison(const TransformOptions& options = TransformOptions{});
+
+    // Results in the order of the transformations. onResult is called on the worker that produced a result, right when
+    // it is ready. A transformation that fails keeps its error in the result, only cancellation stops the others.
+    std::vector<Result> perform(const Image&, const std::vector<Image::Transformation>&, const std::function<void(size_t, const Result&)>& onResult = {}) const;
+
+private:
+    TransformOptions options;
+};
@@ -0,0 +1,101 @@
+#include "TransformHistory.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include "ImageFile.hpp"
+
+TransformHistory::TransformHistory(const size_t maxBytes) : maxBytes{maxBytes}, states{}, current{0}, bytes{0}
+{}
+
+TransformHistory::State TransformHistory::snapshot(const Image& image)
+{
+    State state{image.getTransformation(), {}};
+    if (image.isTransformed())
+    {
+        std::ostringstream file;
+        writeImageFile(file, image.getIndexed());
+        state.file = file.str();
+    }
+    return state;
+}
+
+void TransformHistory::record(State state)
+{
+    while (states.size() > current + 1)
+    {
+        bytes -= states.back().file.size();
+        states.pop_back();
+    }
+
+    bytes += state.file.size();
+    states.push_back(std::move(state));
+    current = states.size() - 1;
+
+    while (bytes > maxBytes and states.size() > 1)
+    {
+        bytes -= states.front().file.size();
+        states.pop_front();
+        --current;
+    }
+}
+
+void TransformHistory::clear()
+{
+    states.clear();
+    current = 0;
+    bytes = 0;
+}
+
+bool TransformHistory::canUndo() const
+{
+    return not states.empty() and current > 0;
+}
+
+bool TransformHistory::canRedo() const
+{
+    return current + 1 < states.size();
+}
+
+void TransformHistory::undo(Image& image)
+{
+    if (not canUndo())
+    {
+        throw std::runtime_error("Nothing to undo");
+    }
+
+    apply(states[current - 1], image);
+    --current;
+}
+
+void TransformHistory::redo(Image& image)
+{
+    if (not canRedo())
+    {
+        throw std::runtime_error("Nothing to redo");
+    }
+
+    apply(states[current + 1], image);
+    ++current;
+}
+
+size_t TransformHistory::getStatesCount() const
+{
+    return states.size();
+}
+
+size_t TransformHistory::getBytes() const
+{
+    return bytes;
+}
+
+void TransformHistory::apply(const State& state, Image& image) const
+{
+    if (state.file.empty())
+    {
+        image.transform(Image::Transformation::none);
+        return;
+    }
+
+    std::istringstream file(state.file);
+    image.restore(state.transformation, readImageFile(file));
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include "Image.hpp"
+
+// Undo and redo of transformations. A state keeps its transformed image as .gkimg bytes in memory, two pixels to a byte
+// and compressed, so stepping back and forth decodes a state instead of transforming again. An image that is not
+// transformed is kept as nothing but that fact. The oldest states are dropped once all of them take more than maxBytes,
+// the current one is always kept.
+class TransformHistory
+{
+public:
+    struct State
+    {
+        Image::Transformation transformation;
+        std::string file;
+    };
+
+    explicit TransformHistory(size_t maxBytes);
+
+    // Encodes the image, which takes as long as saving it, so it may run on a worker instead of the window's thread
+    static State snapshot(const Image&);
+
+    // The state becomes the current one and the states that could be redone are dropped
+    void record(State);
+    void clear();
+
+    bool canUndo() const;
+    bool canRedo() const;
+    // Put the previous or the next state into the image, which must be the one recorded
+    void undo(Image&);
+    void redo(Image&);
+
+    size_t getStatesCount() const;
+    size_t getBytes() const;
+
+private:
+    size_t maxBytes;
+    std::deque<State> states;
+    size_t current;
+    size_t bytes;
+
+    void apply(const State&, Image&) const;
+};
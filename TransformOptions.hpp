@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "ColorSpace.hpp"
+#include "TaskControl.hpp"
+
+class ResultCache;
+
+struct TransformOptions
+{
+    // Bayer matrix size of ordered dithering: 2, 4, 8 or 16
+    size_t ditheringMatrixSize{4};
+    // Serpentine scan improves error diffusion quality, but forces it onto a single thread
+    bool serpentine{false};
+    // Median cut builds its palette from this many pixels sampled one per image stratum, 0 uses every pixel
+    size_t paletteSampleSize{0};
+    uint64_t paletteSampleSeed{0};
+    // Distance used to build median cut palettes and to map pixels onto them
+    ColorMetric colorMetric{ColorMetric::rgb};
+    // Median cut averages, luma and ordered dithering thresholds work in linear light instead of on sRGB bytes
+    bool linearLight{false};
+    // 0 selects std::thread::hardware_concurrency()
+    unsigned threads{0};
+    // Polled for cancellation and told about progress by the long loops of a transformation, may be null
+    TaskControl* control{nullptr};
+    // Looked up before a transformation runs and given its result afterwards, may be null
+    ResultCache* cache{nullptr};
+};